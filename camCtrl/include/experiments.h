@@ -44,6 +44,7 @@ namespace VisMe
   char* generateImageName(char *path, char *nameOut, int *p_lastIndex = NULL);
 
   unsigned int subAverage(void *buf, int dataLength, int numPoints, int offset);
+  void scale14to8bit(const short *in, unsigned char *out, int count);
   unsigned int adaptiveHDRautoexp( int maxExpTime, int targetVal, void *imgBuffer);
 
   void saveImage( char *nameBuff, commonImage::commonImage_t *imBuff,
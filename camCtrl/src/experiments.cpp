@@ -104,6 +104,30 @@ unsigned int subAverage(void *buf, int dataLength = 1, int numPoints = 1000, int
 
 }
 
+/**
+ * Scale 14 bit data to 8 bits for displaying (value*255/16383) using a lookup table
+ * built on the first call (gives the same values as multiplying each pixel)
+ * @param *in pointer to 14 bit data
+ * @param *out pointer to the 8 bit output
+ * @param count number of pixels
+ */
+void scale14to8bit(const short *in, unsigned char *out, int count) {
+	static unsigned char lut[65536];
+	static bool lutReady = false;
+
+	if (!lutReady) {
+		for (int i = 0; i < 65536; i++) {
+			lut[i] = (unsigned char) (int) ((short) i
+					* 0.0155649148507599340780076908991); //magic_num = 255/16383 (14 bit -> 8 bit)
+		}
+		lutReady = true;
+	}
+
+	while (count-- > 0) {
+		*out++ = lut[(unsigned short) *in++];
+	}
+}
+
 /**
  * Capture a stack of images for HDR experiments. The exposuretimes used are given in the
  * ini-file.
@@ -403,14 +427,8 @@ void run_image_stack_capture() {
 							imgBuffer[camId].width, CV_8UC1);
 
 					//Scale data
-					short *in = (short*) (imgBuffer[camId].data);
-					unsigned char *out = image8bpp.data;
-					int count = imgBuffer[camId].height
-							* imgBuffer[camId].width;
-					while (count-- > 0) {
-						*out++ = (char) (*in++
-								* 0.0155649148507599340780076908991); //magic_num = 255/16383 (14 bit -> 8 bit)
-					}
+					scale14to8bit((short*) (imgBuffer[camId].data), image8bpp.data,
+							imgBuffer[camId].height * imgBuffer[camId].width);
 
 					sprintf(windowNameBuffer[camId], "Camera %u", camId + 1);
 					cv::imshow(windowNameBuffer[camId], image8bpp);
@@ -864,14 +882,8 @@ void run_adaptive_hdr_capture() {
 							imgBuffer[camId].width, CV_8UC1);
 
 					//Scale data
-					short *in = (short*) (imgBuffer[camId].data);
-					unsigned char *out = image8bpp.data;
-					int count = imgBuffer[camId].height
-							* imgBuffer[camId].width;
-					while (count-- > 0) {
-						*out++ = (char) (*in++
-								* 0.0155649148507599340780076908991); //magic_num = 255/16383 (14 bit -> 8 bit)
-					}
+					scale14to8bit((short*) (imgBuffer[camId].data), image8bpp.data,
+							imgBuffer[camId].height * imgBuffer[camId].width);
 
 					sprintf(windowNameBuffer[camId], "Camera %u", camId + 1);
 					cv::imshow(windowNameBuffer[camId], image8bpp);
@@ -1028,14 +1040,8 @@ void run_streaming_view() {
 					imgBuffer[camId].width, CV_8UC1);
 
 			//Scale data
-			short *in = (short*) (imgBuffer[camId].data);
-			unsigned char *out = image8bpp.data;
-			int count = imgBuffer[camId].height
-					* imgBuffer[camId].width;
-			while (count-- > 0) {
-				*out++ = (char) (*in++
-						* 0.0155649148507599340780076908991); //magic_num = 255/16383 (14 bit -> 8 bit)
-			}
+			scale14to8bit((short*) (imgBuffer[camId].data), image8bpp.data,
+					imgBuffer[camId].height * imgBuffer[camId].width);
 
 			sprintf(windowNameBuffer[camId], "Camera %u", camId + 1);
 			cv::imshow(windowNameBuffer[camId], image8bpp);
@@ -1338,12 +1344,8 @@ void run_external_signal_capture()
 						imgBuffer[camId].width, CV_8UC1);
 
 				//Scale data
-				short *in = (short*) (imgBuffer[camId].data);
-				unsigned char *out = image8bpp.data;
-				int count = imgBuffer[camId].height * imgBuffer[camId].width;
-				while (count-- > 0) {
-					*out++ = (char) (*in++ * 0.0155649148507599340780076908991); //magic_num = 255/16383 (14 bit -> 8 bit)
-				}
+				scale14to8bit((short*) (imgBuffer[camId].data), image8bpp.data,
+						imgBuffer[camId].height * imgBuffer[camId].width);
 
 				sprintf(windowNameBuffer[camId], "Camera %u", camId + 1);
 				cv::imshow(windowNameBuffer[camId], image8bpp);
@@ -0,0 +1,170 @@
+/******************************************************************************
+ * benchClahe.cpp
+ *
+ * The CLAHE inner loops against the Graphics Gems reference (clahe.cpp) on a
+ * synthetic 12 bit 1280x960 image (as the -c data, 16x16 regions, 256 bins):
+ *
+ * 1) region histograms: MakeHistogram vs MakeHistogramCopies
+ * 2) interpolation of the sub-blocks: Interpolate (a division per pixel) vs
+ *    InterpolateRows (claheBlendU16 rows, reciprocal) for each instruction set
+ * 3) the whole Clahe vs ClaheParallel
+ *
+ * Returns non zero if any result differs from the reference.
+ *
+ *  invoke> make bench && ./bin/x86_64bit/benchClahe [-j threads]
+ *
+ *  Sami Varjo 2014
+ *******************************************************************************/
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <sys/time.h>
+
+#include "clahe.h"
+#include "parallel.h"
+#include "simdKernels.h"
+
+static double timeNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static const unsigned int width = 1280, height = 960;
+static const unsigned int nrX = 16, nrY = 16, nrBins = 256;
+static const kz_pixel_t maxVal = uiNR_OF_GREY-1;
+
+//sub-blocks of the interpolation as in Clahe (regions of even size)
+static void interpolateAll( kz_pixel_t *image, std::vector<unsigned long> &maps, std::vector<uint32_t> &maps32,
+							kz_pixel_t *lut, uint32_t *lut32, bool rows )
+{
+	const unsigned int xSize = width/nrX, ySize = height/nrY;
+	kz_pixel_t *p = image;
+	for (unsigned int y = 0; y <= nrY; y++){
+		unsigned int subY = (y == 0 || y == nrY) ? ySize/2 : ySize;
+		unsigned int yu = (y == 0) ? 0 : y-1, yb = (y == nrY) ? nrY-1 : y;
+		for (unsigned int x = 0; x <= nrX; x++){
+			unsigned int subX = (x == 0 || x == nrX) ? xSize/2 : xSize;
+			unsigned int xl = (x == 0) ? 0 : x-1, xr = (x == nrX) ? nrX-1 : x;
+			unsigned int lu = nrBins*(yu*nrX + xl), ru = nrBins*(yu*nrX + xr);
+			unsigned int lb = nrBins*(yb*nrX + xl), rb = nrBins*(yb*nrX + xr);
+			if (rows) { InterpolateRows( p, width, &maps32[lu], &maps32[ru], &maps32[lb], &maps32[rb], subX, subY, lut32, NULL ); }
+			else      { Interpolate( p, width, &maps[lu], &maps[ru], &maps[lb], &maps[rb], subX, subY, lut, NULL ); }
+			p += subX;
+		}
+		p += (subY-1)*width;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int rounds = 20;
+	for (int i=1; i<argc-1; i++){
+		std::string argStr = std::string(argv[i]);
+		if (argStr == "-j") { setThreadCount( atoi(argv[++i]) ); }
+	}
+
+	//smooth gradients and noise, the upper part dark and flat (long runs of the same bin as at night)
+	const unsigned int pixels = width*height;
+	std::vector<kz_pixel_t> image( pixels ), work( pixels ), ref( pixels );
+	srand(1);
+	for (unsigned int y = 0; y < height; y++){
+		for (unsigned int x = 0; x < width; x++){
+			float v = 0.5f + 0.3f*sinf(x*0.01f)*cosf(y*0.013f) + 0.2f*(rand()/(float)RAND_MAX - 0.5f);
+			if (y < height/3) { v = 0.05f + 0.002f*(rand()/(float)RAND_MAX); }
+			image[y*width + x] = (kz_pixel_t)(v*maxVal);
+		}
+	}
+	std::cout << width << "x" << height << " 12 bit, " << nrX << "x" << nrY << " regions, " << nrBins << " bins, threads: "
+			  << getThreadCount() << ", SIMD: " << simdLevelName(getSimdLevel()) << std::endl;
+	bool ok = true;
+
+	//1) histograms of the regions
+	const unsigned int xSize = width/nrX, ySize = height/nrY;
+	kz_pixel_t lut[uiNR_OF_GREY];
+	MakeLut( lut, 0, maxVal, nrBins );
+	std::vector<unsigned long> hist[2], copies( uiHIST_COPIES*nrBins );
+	hist[0].resize( nrX*nrY*nrBins );
+	hist[1].resize( nrX*nrY*nrBins );
+	double ms[2] = {1e9, 1e9};
+	for (int r = 0; r < rounds; r++){
+		for (int mode = 0; mode < 2; mode++){
+			double t = timeNow();
+			for (unsigned int id = 0; id < nrX*nrY; id++){
+				kz_pixel_t *region = &image[(id/nrX)*ySize*width + (id%nrX)*xSize];
+				if (mode == 0) { MakeHistogram( region, width, xSize, ySize, &hist[0][id*nrBins], nrBins, lut ); }
+				else           { MakeHistogramCopies( region, width, xSize, ySize, &hist[1][id*nrBins], nrBins, lut, &copies[0] ); }
+			}
+			t = timeNow()-t;
+			if (t < ms[mode]) { ms[mode] = t; }
+		}
+	}
+	bool same = hist[0] == hist[1];
+	ok = ok && same;
+	std::cout << "histograms MakeHistogram: " << ms[0]*1e3 << " ms, MakeHistogramCopies: " << ms[1]*1e3 << " ms ("
+			  << ms[0]/ms[1] << "x) " << (same ? "identical" : "DIFFER") << std::endl;
+
+	//2) interpolation with the mappings of the regions
+	std::vector<unsigned long> maps( hist[0] );
+	unsigned long clipLimit = (unsigned long)(10.0f * (xSize*ySize) / nrBins);
+	for (unsigned int id = 0; id < nrX*nrY; id++){
+		ClipHistogram( &maps[id*nrBins], nrBins, clipLimit );
+		MapHistogram( &maps[id*nrBins], 0, maxVal, nrBins, (unsigned long)xSize*ySize );
+	}
+	std::vector<uint32_t> maps32( maps.begin(), maps.end() ), lut32( lut, lut+uiNR_OF_GREY );
+
+	double msRef = 1e9;
+	for (int r = 0; r < rounds; r++){
+		ref = image;
+		double t = timeNow();
+		interpolateAll( &ref[0], maps, maps32, lut, &lut32[0], false );
+		t = timeNow()-t;
+		if (t < msRef) { msRef = t; }
+	}
+	std::cout << "interpolation Interpolate: " << msRef*1e3 << " ms" << std::endl;
+	simdLevel_e best = getSimdLevel();
+	for (int level = SIMD_NONE; level <= best; level++){
+		setSimdLevel( (simdLevel_e)level );
+		double msRows = 1e9;
+		for (int r = 0; r < rounds; r++){
+			work = image;
+			double t = timeNow();
+			interpolateAll( &work[0], maps, maps32, lut, &lut32[0], true );
+			t = timeNow()-t;
+			if (t < msRows) { msRows = t; }
+		}
+		same = work == ref;
+		ok = ok && same;
+		std::cout << "interpolation InterpolateRows " << simdLevelName((simdLevel_e)level) << ": " << msRows*1e3 << " ms ("
+				  << msRef/msRows << "x) " << (same ? "identical" : "DIFFER") << std::endl;
+	}
+	setSimdLevel( best );
+
+	//3) the whole CLAHE
+	for (int mode = 0; mode < 2; mode++){
+		double msMode = 1e9;
+		for (int r = 0; r < rounds; r++){
+			work = image;
+			double t = timeNow();
+			if (mode == 0) { Clahe( &work[0], width, height, 0, maxVal, nrX, nrY, nrBins, 10.0f ); }
+			else           { ClaheParallel( &work[0], width, height, 0, maxVal, nrX, nrY, nrBins, 10.0f ); }
+			t = timeNow()-t;
+			if (t < msMode) { msMode = t; }
+		}
+		if (mode == 0) {
+			ref = work;
+			msRef = msMode;
+			std::cout << "Clahe: " << msMode*1e3 << " ms" << std::endl;
+		}
+		else {
+			same = work == ref;
+			ok = ok && same;
+			std::cout << "ClaheParallel: " << msMode*1e3 << " ms (" << msRef/msMode << "x) " << (same ? "identical" : "DIFFER") << std::endl;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/******************************************************************************
+ * benchLog1p.cpp
+ *
+ * Accuracy and speed of the fast log(1+x) (log1pF32) against logf.
+ *
+ * 1) error of log1pF32 and logf(1+x) to log(1+x) in double (1+x rounded to
+ *    float as in both) for every 16th float on [0 1] and random x on [1 1e6]
+ * 2) the instruction set versions give bit identical results
+ * 3) retinex filter (multiscaleRetinexFilter and -Gauss) outputs and the
+ *    mean response (as in processHDR) with logf and with log1pF32 on a
+ *    synthetic 1280x960 image
+ *
+ * Returns non zero if the documented max error (simdKernels.h) is exceeded
+ * or the instruction set versions differ.
+ *
+ *  invoke> make bench && ./bin/x86_64bit/benchLog1p [-j threads]
+ *
+ *  Sami Varjo 2014
+ *******************************************************************************/
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "imageProcessing.h"
+#include "parallel.h"
+#include "simdKernels.h"
+
+static double timeNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//max abs and relative error of fast and logf to log(1+x) in double
+static void logErrors( const std::vector<float> &x, double err[4] )
+{
+	std::vector<float> fast( x.size() );
+	log1pF32( &x[0], &fast[0], (int)x.size() );
+
+	for (size_t i = 0; i < x.size(); i++){
+		double ref = log( (double)(1 + x[i]) );
+		double eFast = fabs( fast[i] - ref );
+		double eLogf = fabs( logf(1 + x[i]) - ref );
+		if (eFast > err[0]) { err[0] = eFast; }
+		if (eLogf > err[1]) { err[1] = eLogf; }
+		if (ref > 0 && eFast/ref > err[2]) { err[2] = eFast/ref; }
+		if (ref > 0 && eLogf/ref > err[3]) { err[3] = eLogf/ref; }
+	}
+}
+
+static double meanResponse( commonImage_t *img )
+{
+	normaliseGrayToFloat( img, img );
+	return totalSum( img ) / (double)((*img).width*(*img).height);
+}
+
+int main(int argc, char** argv)
+{
+	for (int i=1; i<argc-1; i++){
+		std::string argStr = std::string(argv[i]);
+		if (argStr == "-j") { setThreadCount( atoi(argv[++i]) ); }
+	}
+
+	const double maxAbsErr = 5e-8; //as documented in simdKernels.h
+	const double maxRelErr = 1e-7;
+	bool ok = true;
+
+	//1) accuracy
+	std::vector<float> x;
+	for (uint32_t u = 0; u <= 0x3f800000; u += 16){
+		float v;
+		memcpy( &v, &u, sizeof(v) );
+		x.push_back( v );
+	}
+	double errUnit[4] = {0, 0, 0, 0};
+	logErrors( x, errUnit );
+
+	srand(1);
+	x.assign( 1<<22, 0 );
+	for (size_t i = 0; i < x.size(); i++){
+		x[i] = (float)pow( 10.0, 6.0*rand()/RAND_MAX );
+	}
+	double errLarge[4] = {0, 0, 0, 0};
+	logErrors( x, errLarge );
+
+	std::cout << "SIMD: " << simdLevelName(getSimdLevel()) << ", threads: " << getThreadCount() << std::endl;
+	std::cout << "x on [0 1]   max abs error log1pF32: " << errUnit[0] << " logf: " << errUnit[1] << std::endl;
+	std::cout << "x on [1 1e6] max rel error log1pF32: " << errLarge[2] << " logf: " << errLarge[3] << std::endl;
+	if (errUnit[0] > maxAbsErr || errLarge[2] > maxRelErr){
+		std::cout << "ERROR larger than documented" << std::endl;
+		ok = false;
+	}
+
+	//2) instruction set versions
+	std::vector<float> ref( x.size() ), out( x.size() );
+	log1pF32_C( &x[0], &ref[0], (int)x.size() );
+	simdLevel_e best = getSimdLevel();
+	for (int level = SIMD_SSE41; level <= best; level++){
+		setSimdLevel( (simdLevel_e)level );
+		log1pF32( &x[0], &out[0], (int)x.size() );
+		bool same = memcmp( &ref[0], &out[0], x.size()*sizeof(float) ) == 0;
+		std::cout << simdLevelName((simdLevel_e)level) << " vs C: " << (same ? "identical" : "DIFFER") << std::endl;
+		ok = ok && same;
+	}
+	setSimdLevel( best );
+
+	//speed of the kernels alone
+	double best0 = 1e9, best1 = 1e9;
+	for (int r = 0; r < 10; r++){
+		double t = timeNow();
+		for (size_t i = 0; i < x.size(); i++) { out[i] = logf( 1 + x[i] ); }
+		t = timeNow()-t;
+		if (t < best0) { best0 = t; }
+		t = timeNow();
+		log1pF32( &x[0], &out[0], (int)x.size() );
+		t = timeNow()-t;
+		if (t < best1) { best1 = t; }
+	}
+	std::cout << "log(1+x) per value logf: " << best0/x.size()*1e9 << " ns, log1pF32: " << best1/x.size()*1e9 << " ns" << std::endl;
+
+	//3) retinex outputs
+	int width = 1280, height = 960;
+	int pixels = width*height;
+	commonImage_t in(Float1D, width, height, malloc(pixels*sizeof(float)));
+	float *p = (float*)in.data;
+	for (int y = 0; y < height; y++){
+		for (int c = 0; c < width; c++){ //smooth gradients and noise on [0 1]
+			float v = 0.5f + 0.3f*sinf(c*0.01f)*cosf(y*0.013f) + 0.2f*(rand()/(float)RAND_MAX - 0.5f);
+			*p++ = v;
+		}
+	}
+
+	const char *names[2] = {"retinex 9x9", "retinex Gauss"};
+	for (int variant = 0; variant < 2; variant++){
+		commonImage_t res[2];
+		double ms[2];
+		for (int fast = 0; fast < 2; fast++){
+			ms[fast] = 1e9;
+			for (int r = 0; r < 5; r++){
+				double t = timeNow();
+				if (variant == 0) { multiscaleRetinexFilter( &in, &res[fast], NULL, fast == 1 ); }
+				else              { multiscaleRetinexFilterGauss( &in, &res[fast], NULL, fast == 1 ); }
+				t = timeNow()-t;
+				if (t < ms[fast]) { ms[fast] = t; }
+			}
+		}
+		double maxDiff = 0;
+		for (int i = 0; i < pixels; i++){
+			double d = fabs( ((float*)res[0].data)[i] - ((float*)res[1].data)[i] );
+			if (d > maxDiff) { maxDiff = d; }
+		}
+		double resp0 = meanResponse( &res[0] );
+		double resp1 = meanResponse( &res[1] );
+		std::cout << names[variant] << ": logf " << ms[0]*1e3 << " ms, log1pF32 " << ms[1]*1e3 << " ms, max output diff " << maxDiff
+				  << ", mean response " << resp0 << " vs " << resp1 << " (diff " << resp1-resp0 << ")" << std::endl;
+		free(res[0].data);
+		free(res[1].data);
+	}
+
+	free(in.data);
+	return ok ? 0 : 1;
+}
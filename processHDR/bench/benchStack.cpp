@@ -0,0 +1,90 @@
+/******************************************************************************
+ * benchStack.cpp
+ *
+ * Benchmark for the exposure weighted stack merge: image by image
+ * (sumGrayStackWExpTimes) versus tile by tile (sumGrayStackWExpTimesTiled).
+ *
+ * A synthetic 16 bit stack is used (def 22 images of 1280x960 as from GT1290).
+ * The memory traffic is estimated from the buffer sizes: image by image merge
+ * reads and writes the whole float sum for every image while the tiled one
+ * keeps the sum tile in cache and writes it once.
+ *
+ *  invoke> make bench && ./bin/x86_64bit/benchStack [-n images] [-t tilePixels] [-j threads]
+ *
+ *  Sami Varjo 2014
+ *******************************************************************************/
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#include "imageProcessing.h"
+#include "parallel.h"
+#include "simdKernels.h"
+
+static double timeNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+int main(int argc, char** argv)
+{
+	int width = 1280, height = 960;
+	int nImages = 22;
+	int tilePixels = 16384;
+	int rounds = 20;
+
+	for (int i=1; i<argc-1; i++){
+		std::string argStr = std::string(argv[i]);
+		if (argStr == "-n")      { nImages = atoi(argv[++i]); }
+		else if (argStr == "-t") { tilePixels = atoi(argv[++i]); }
+		else if (argStr == "-j") { setThreadCount( atoi(argv[++i]) ); }
+	}
+
+	int pixels = width*height;
+	float *expTimes = (float*)malloc(nImages*sizeof(float));
+	std::vector<commonImage_t> stack;
+	srand(1);
+	for (int id=0; id < nImages; id++){
+		commonImage_t im(Gray16bpp, width, height, malloc(pixels*sizeof(unsigned short)));
+		unsigned short *p = (unsigned short*)im.data;
+		for (int c=0; c < pixels; c++) { *p++ = rand() & 0x3fff; }
+		stack.push_back(im);
+		expTimes[id] = (float)(25 << (id%22));
+	}
+
+	std::cout << nImages << " images " << width << "x" << height << ", threads: " << getThreadCount()
+			  << ", SIMD: " << simdLevelName(getSimdLevel()) << ", tile: " << tilePixels << " pixels" << std::endl;
+
+	double inMB  = nImages*(double)pixels*sizeof(unsigned short)/1e6;
+	double sumMB = (double)pixels*sizeof(float)/1e6;
+
+	const char *names[2] = {"image by image", "tiled"};
+	double traffic[2] = { inMB + nImages*2*sumMB, inMB + sumMB };
+	commonImage_t out[2];
+
+	for (int mode=0; mode < 2; mode++){
+		double best = 1e9;
+		for (int r=0; r < rounds; r++){
+			if (out[mode].data != NULL) { memset( out[mode].data, 0, pixels*sizeof(float) ); }
+			double t = timeNow();
+			if (mode == 0) { sumGrayStackWExpTimes( stack, expTimes, &out[mode] ); }
+			else           { sumGrayStackWExpTimesTiled( stack, expTimes, &out[mode], -1, tilePixels ); }
+			t = timeNow()-t;
+			if (t < best) { best = t; }
+		}
+		std::cout << names[mode] << ": " << best*1e3 << " ms, est. memory traffic " << traffic[mode] << " MB, "
+				  << traffic[mode]/best/1e3 << " GB/s" << std::endl;
+	}
+
+	bool same = memcmp( out[0].data, out[1].data, pixels*sizeof(float) ) == 0;
+	std::cout << "results " << (same ? "identical" : "DIFFER") << std::endl;
+
+	releaseStackData( stack );
+	free(out[0].data);
+	free(out[1].data);
+	free(expTimes);
+	return same ? 0 : 1;
+}
@@ -27,6 +27,9 @@
 #ifndef CLAHE_H
 #define CLAHE_H
 
+#include <stdint.h>
+#include "imageProcessing.h"	/* imageStats_t */
+
 //#define IMAGE_8_BIT 
 
 #ifdef IMAGE_8_BIT
@@ -40,11 +43,53 @@
 
 const unsigned int uiMAX_REG_X = 32;	  /* max. # contextual regions in x-direction */
 const unsigned int uiMAX_REG_Y = 32;	  /* max. # contextual regions in y-direction */
+const unsigned int uiHIST_COPIES = 4;	  /* histogram copies in MakeHistogramCopies (fixed, the count is unrolled) */
 
 /******** Prototype of CLAHE function. Put this in a separate include file. *****/
 int Clahe(kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes, kz_pixel_t Min,
           kz_pixel_t Max, unsigned int uiNrX, unsigned int uiNrY,
-          unsigned int uiNrBins, float fCliplimit);
+          unsigned int uiNrBins, float fCliplimit, unsigned long* pulOutHist = 0);
+
+/* As Clahe (same parameters and identical output) but the contextual region histograms
+ * and the interpolation of the sub-blocks are run on the worker pool (parallel.h).
+ * pulOutHist is counted per worker and summed at the end. */
+int ClaheParallel(kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes, kz_pixel_t Min,
+          kz_pixel_t Max, unsigned int uiNrX, unsigned int uiNrY,
+          unsigned int uiNrBins, float fCliplimit, unsigned long* pulOutHist = 0);
+
+/* Work buffers of ClaheT (mappings, histograms, lookup table). Kept over the calls when given 
+ * so the memory is allocated once (eg. for all stacks of a batch run). */
+typedef struct _claheWork{
+    std::vector<unsigned long> ulMaps;	   /* mappings of the regions (integer data) */
+    std::vector<float> fMaps;		   /* mappings of the regions (float data) */
+    std::vector<unsigned long> ulWorkerHist; /* region histogram (and its copies) of each worker */
+    std::vector<imageStats_t> blockStats;  /* output stats of the sub-blocks */
+    std::vector<unsigned int> LUT;	   /* bins of integer values */
+}claheWork_t;
+
+/* Release the memory of the work buffers */
+void claheWorkRelease(claheWork_t* pWork);
+
+/* CLAHE directly on 8 bit, 16 bit or float data (T unsigned char, unsigned short or float),
+ * run on the worker pool as ClaheParallel. The number of bins is set at run time: integer 
+ * data is binned with a lookup table over the whole range of T (as MakeLut, values outside
+ * [Min,Max] go to the first or last bin), float data with (value-Min)*uiNrBins/(Max-Min).
+ * For float data the mappings and the interpolation are done in float (no quantization).
+ *
+ * Any image size and number of regions can be used (uiNrX <= uiXRes, uiNrY <= uiYRes, no
+ * uiMAX_REG limits): the regions are ceil(uiXRes/uiNrX) x ceil(uiYRes/uiNrY) pixels and the 
+ * image is extended to the right and bottom by mirroring (virtually, the image is not copied).
+ * For integer data with even region sizes dividing the image the result is the same as from 
+ * Clahe with the same parameters.
+ *
+ * Parameters and return values as in Clahe except
+ *   pStats - if not NULL stats of the output image (counted as the pixels are written)
+ *   pWork  - work buffers kept over calls (if NULL allocated for the call)
+ */
+template <typename T>
+int ClaheT(T* pImage, unsigned int uiXRes, unsigned int uiYRes, T Min, T Max, 
+          unsigned int uiNrX, unsigned int uiNrY, unsigned int uiNrBins, float fCliplimit, 
+          imageStats_t* pStats = 0, claheWork_t* pWork = 0);
 
 /*********************** Local prototypes ************************/
 void ClipHistogram (unsigned long*, unsigned int, unsigned long);
@@ -54,7 +99,21 @@ void MapHistogram (unsigned long*, kz_pixel_t, kz_pixel_t,
                    unsigned int, unsigned long);
 void MakeLut (kz_pixel_t*, kz_pixel_t, kz_pixel_t, unsigned int);
 void Interpolate (kz_pixel_t*, int, unsigned long*, unsigned long*,
-                  unsigned long*, unsigned long*, unsigned int, unsigned int, kz_pixel_t*);
+                  unsigned long*, unsigned long*, unsigned int, unsigned int, kz_pixel_t*,
+                  unsigned long*);
+
+/* As MakeHistogram but consecutive pixels are counted to uiHIST_COPIES copies of the histogram
+ * (in pulCopies, uiHIST_COPIES*uiNrGreylevels) summed at the end, so that the increments of 
+ * the same bin do not wait for each other */
+void MakeHistogramCopies (kz_pixel_t*, unsigned int, unsigned int, unsigned int,
+                          unsigned long*, unsigned int, kz_pixel_t*, unsigned long*);
+#ifndef IMAGE_8_BIT
+/* As Interpolate with 32 bit mappings and lookup table, the rows are blended with claheBlendU16 
+ * (simdKernels.h, no division). The mappings times uiXSize*uiYSize must stay below 2^31. */
+void InterpolateRows (kz_pixel_t*, int, const uint32_t*, const uint32_t*,
+                      const uint32_t*, const uint32_t*, unsigned int, unsigned int, const uint32_t*,
+                      unsigned long*);
+#endif
 
 
 #endif
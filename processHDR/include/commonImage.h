@@ -100,7 +100,8 @@ namespace commonImage{
    * data (so the data won't be packed over several bytes)
    *
    * @param path the input image filename
-   * @param image the image to be populated. The data in image.data is allocated here.
+   * @param image the image to be populated. The data in image.data is allocated here. If image.data is not NULL
+   *              and the image has the same size and type as in the file the buffer is reused (else it is freed).
    * @param verbose to give or not extra output at std::cout or std::cerr
    */
   int readTIFF (const char *path, commonImage_t *image, bool verbose=false );
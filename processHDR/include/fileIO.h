@@ -61,6 +61,13 @@ namespace FileIO{
    */
   void getFileNames(std::vector<std::string>  &files, std::string path, std::string prefix="*", std::string suffix="*");
 
+  /**
+   * List sub folder names in the folder (sorted, . and .. excluded)
+   * @param &dirs a vector of strings for the result
+   * @param path folder location 
+   */
+  void getDirNames(std::vector<std::string>  &dirs, std::string path);
+
 } //end namespace FileIO
 
 #endif 
@@ -6,7 +6,7 @@
  * Image processing tasks using common image type.
  *
  * Depend on: commonImage.h
- * API: sumGrayStack, sumGrayStackWExpTimes
+ * API: sumGrayStack, sumGrayStackWExpTimes, hdrAccumulator*, exposureSelector*, imageStats_t
  *
  * namespace:  commonImage::
  *
@@ -18,10 +18,35 @@
 #ifndef IMAGEPROCESSING_H
 #define IMAGEPROCESSING_H
 
+#include <stdint.h>
 #include "commonImage.h"
 
 using namespace commonImage;
 
+   /**
+    * Statistics of image data. The functions producing an image can fill these in while 
+	* writing it so that the functions using the image next (normalisers, totalSum) do not
+	* need to scan it again. Min and max are over all pixels (NaN values skipped).
+	* The stats are valid only for the image data they were made for.
+	*/
+   typedef struct _imageStats{
+     _imageStats(): valid(false), minVal(0), maxVal(0), sum(0), count(0){};
+
+     bool valid;     ///false if not computed
+     double minVal;  ///smallest pixel value
+     double maxVal;  ///largest pixel value
+     double sum;     ///sum of pixel values
+     int count;      ///number of pixels
+   }imageStats_t;
+
+   /**
+    * Stats from histogram of integer data (bin i counts pixels of value i)
+	* @param hist  the histogram
+	* @param bins  number of bins
+	* @param stats the result (not valid if histogram is empty)
+	*/
+   void imageStatsFromHistogram( const unsigned long *hist, int bins, imageStats_t *stats );
+
 
    /**
     *Create a sum image from stack of images 
@@ -41,14 +66,97 @@ using namespace commonImage;
 	*/ 
    int sumGrayStackWExpTimes( std::vector<commonImage_t> &stack, float *expTimes, commonImage_t *output, int maxIdx=-1);
 
+   /**
+    *As sumGrayStackWExpTimes (identical result) but the stack is merged in tiles of tilePixels
+	* pixels: all images are added to a tile before moving to the next one so the sum stays
+	* in cache and is written to memory only once. The tiles are shared to threads (parallel.h).
+	* @param stack  vector of standard images
+	* @param expTimes array of exposure times (float)
+	* @param output the result image structure. If output.data is NULL a new buffer of Float1D is allocated
+	* @param maxIdx use only N first images (if -1) use all;
+	* @param tilePixels number of pixels in tile (def 16384 ie 64kB of sum)
+	* @param stats  if not NULL stats of output (computed from each tile while in cache)
+	* @return error code, zero if success negative on error (eg memory allocation)
+	*/ 
+   int sumGrayStackWExpTimesTiled( std::vector<commonImage_t> &stack, float *expTimes, commonImage_t *output, int maxIdx=-1, int tilePixels=16384,
+                                   imageStats_t *stats=NULL);
+
+   /**
+    * Streaming version of sumGrayStackWExpTimes: the images are added one at a time
+	* so that the whole stack do not need to be in memory (open -> add N times -> finalize)
+	*/
+   typedef struct _hdrAccumulator{
+     _hdrAccumulator(): sum(Float1D), frames(0), exact(false), exactSum(NULL), exactPixels(0){};
+
+     commonImage_t sum;  ///the exposure time weighted sum (Float1D)
+     int frames;         ///number of images added
+     bool exact;         ///exact integer sum in use
+     uint64_t *exactSum; ///the exact sum (if exact)
+     int exactPixels;    ///size of exactSum buffer
+   }hdrAccumulator_t;
+
+   /**
+    * Prepare accumulator for a new stack. The sum buffer is (re)allocated only if
+	* there is no suitable buffer already (eg from previous stack)
+	* @param acc    the accumulator
+	* @param width  width of the images in stack
+	* @param height height of the images in stack
+	* @param exact  sum in 64 bit integers (exact and reproducible, only for integer images and 
+	*               exposure times see isExactExposureTime), converted to float in finalize
+	* @return error code, zero if success negative on error (eg memory allocation)
+	*/
+   int hdrAccumulatorOpen( hdrAccumulator_t *acc, int width, int height, bool exact=false );
+
+   /**
+    * Add image weighted with its exposure time to the sum. The image can be released after the call.
+	* @param acc     the accumulator (opened)
+	* @param image   the image to be added (same size as given in hdrAccumulatorOpen)
+	* @param expTime the exposure time for the image
+	* @return error code, zero if success negative on error (eg size mismatch, RGB data or
+	*         float data / not integer exposure time with exact sum)
+	*/
+   int hdrAccumulatorAdd( hdrAccumulator_t *acc, commonImage_t *image, float expTime );
+
+   /**
+    * Hand the sum over to output (Float1D) as sumGrayStackWExpTimes would give it.
+	* The previous buffer of output is kept in accumulator for the next stack.
+	* @param acc    the accumulator
+	* @param output the result image
+	* @param stats  if not NULL stats of output, valid only with exact sum (computed in the
+	*               conversion to float, the float sum has no final pass)
+	* @return error code, zero if success negative on error
+	*/
+   int hdrAccumulatorFinalize( hdrAccumulator_t *acc, commonImage_t *output, imageStats_t *stats=NULL );
+
+   /**
+    * Release the memory held by accumulator
+	* @param acc the accumulator
+	*/
+   void hdrAccumulatorRelease( hdrAccumulator_t *acc );
+
+   /**
+    * Test if exposure time can be used with exact sum (integer in range 0..2^32-1).
+	* The exact sum do not overflow as long as sum of pixel*expTime over stack < 2^64
+	* (eg 16 bit data with 22 exposure times up to 52428800 uses less than 2^43)
+	* @param expTime the exposure time
+	* @return true if ok
+	*/
+   bool isExactExposureTime( float expTime );
+
   /**
    * Convert and normalise a gray scale image to 8 bit format (eg for displaying)
+   * 
+   * All normalisers take optional stats: with valid inStats of input the min and max scan 
+   * is skipped (single pass), outStats is filled with the stats of output (may be the same 
+   * as inStats). 
    *
    * @param input the image to be normalised to range 0-255
    * @param output a pointer to fresh commonImage_t. output.data is expected to be NULL and a new buffer will be allocated (if not null it is freed).
+   * @param inStats  stats of input or NULL
+   * @param outStats stats of output or NULL
    * @return error code, zero if success negative on error
    */
-   int normaliseGrayTo8bit( commonImage_t *input, commonImage_t *output );
+   int normaliseGrayTo8bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats=NULL, imageStats_t *outStats=NULL );
   
   /**
    * Convert and normalise a gray scale image to 8 bit format (eg for displaying)
@@ -57,7 +165,7 @@ using namespace commonImage;
    * @param output a pointer to fresh commonImage_t. output.data is expected to be NULL and a new buffer will be allocated (if not null it is freed).
    * @return error code, zero if success negative on error
    */
-   int normaliseGrayTo12bit( commonImage_t *input, commonImage_t *output );
+   int normaliseGrayTo12bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats=NULL, imageStats_t *outStats=NULL );
     
   
   /**
@@ -68,7 +176,7 @@ using namespace commonImage;
  (if not null it is freed).
    * @return error code, zero if success negative on error 
    */
-   int normaliseGrayTo32bit( commonImage_t *input, commonImage_t *output );
+   int normaliseGrayTo32bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats=NULL, imageStats_t *outStats=NULL );
    
   /**
    * Normalise a gray scale image to double format (eg for displaying)
@@ -77,7 +185,7 @@ using namespace commonImage;
    * @param output a pointer to commonImage_t .data (re)allocated if no suitable buffer is detected
    * @return error code, zero if success negative on error 
    */
-   int normaliseGrayToDouble( commonImage_t *input, commonImage_t *output );
+   int normaliseGrayToDouble( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats=NULL, imageStats_t *outStats=NULL );
   
    /**
    * Normalise a gray scale image to float format (eg for displaying)
@@ -86,7 +194,7 @@ using namespace commonImage;
    * @param output a pointer to commonImage_t .data (re)allocated if no suitable buffer is detected
    * @return error code, zero if success negative on error 
    */
-   int normaliseGrayToFloat( commonImage_t *input, commonImage_t *output );
+   int normaliseGrayToFloat( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats=NULL, imageStats_t *outStats=NULL );
    
    /**
     * Release the memory allocatd by the images in vector stack
@@ -96,12 +204,142 @@ using namespace commonImage;
    
    /**
     * Find the image index that is is not yet highly overexposed in image stack (may be severly but...)
+	* The histogram of the 8 bit normalised image is computed directly from the 8-16 bit data
+	* in single pass (no 8 bit image is made). 
 	* @param stack std::vector<commonImage_t> containing images
 	* @param th the required threshold for cumulative distribution of histogram 
 	*	        saturated at the last bin (cdf[254] < th && cdf[255] > th)
+	* @param rowStep use only every rowStep:th row for the histogram (1 for all rows)
 	* @return id of the image over exposed 
 	*/
-   int findLastOkExposureImage( std::vector<commonImage_t> &stack , double th=0.5);
+   int findLastOkExposureImage( std::vector<commonImage_t> &stack , double th=0.5, int rowStep=1);
+
+   /**
+    * Image source for findLastOkExposure. Return the image at position id in stack or NULL
+	* on error. The returned image need to be valid only until the next call.
+	*/
+   typedef commonImage_t* (*stackLoader_t)( int id, void *ctx );
+
+   /**
+    * As findLastOkExposureImage but the images are requested one at a time from loadImage
+	* (eg read from files) so that the stack do not need to be in memory.
+	* @param stackSize number of images in the stack
+	* @param loadImage function giving the image at given position
+	* @param ctx       passed to loadImage as is
+	* @param th        as in findLastOkExposureImage
+	* @param rowStep   as in findLastOkExposureImage
+	* @return id of the image over exposed (negative if not found)
+	*/
+   int findLastOkExposure( int stackSize, stackLoader_t loadImage, void *ctx, double th=0.5, int rowStep=1);
+
+   /**
+    * Exposure check done while the stack is read in increasing exposure order (selection first).
+	* The images are given one at a time (exposureSelectorAdd) and with th <= 0.5 the selection 
+	* is known as soon as the first ok image is seen so the rest of the stack need not be read.
+	* The result is the same as from findLastOkExposure.
+	*/
+   typedef struct _exposureSelector{
+     _exposureSelector(): stackSize(0), th(0.5), rowStep(1), nativeHist(NULL){};
+
+     int stackSize;                ///number of images in stack
+     double th;                    ///as in findLastOkExposureImage
+     int rowStep;                  ///as in findLastOkExposureImage
+     std::vector<bool> tested;     ///images checked so far
+     std::vector<double> cdfLow;   ///cdf[0] of checked images
+     std::vector<double> cdfHigh;  ///cdf[254] of checked images
+     unsigned int *nativeHist;     ///work buffers
+     commonImage_t imBuf;
+   }exposureSelector_t;
+
+   /**
+    * Prepare selector for a new stack (work buffers are kept from previous stack)
+	* @param sel       the selector
+	* @param stackSize number of images in stack
+	* @param th        as in findLastOkExposureImage
+	* @param rowStep   as in findLastOkExposureImage
+	* @return error code, zero if success negative on error
+	*/
+   int exposureSelectorOpen( exposureSelector_t *sel, int stackSize, double th=0.5, int rowStep=1 );
+
+   /**
+    * Check image at position id in the stack (give images in increasing id order)
+	* @param sel   the selector
+	* @param id    position of the image in stack
+	* @param image the image
+	* @return 1 if the selection is final (images after exposureSelectorResult() are not needed), 
+	*         0 if not and negative on error
+	*/
+   int exposureSelectorAdd( exposureSelector_t *sel, int id, commonImage_t *image );
+
+   /**
+    * @param sel the selector
+	* @return id of the image over exposed (negative if not found) as from findLastOkExposure
+	*/
+   int exposureSelectorResult( exposureSelector_t *sel );
+
+   /**
+    * Release work buffers of the selector
+	* @param sel the selector
+	*/
+   void exposureSelectorRelease( exposureSelector_t *sel );
+
+   /**
+    * Low pass filters of the multiscale retinex
+	*/
+   typedef enum _retinexLowPass{
+     RETINEX_LP_KERNEL,     /// Gaussians sampled in a small window (retinexKernels_t, def 9x9 as in the Matlab implementation)
+     RETINEX_LP_RECURSIVE,  /// Gaussians with full support with recursive filters (gaussianRecursive_Float)
+     RETINEX_LP_BOX         /// the same Gaussians approximated with box filter cascades (gaussianBox_Float)
+   } retinexLowPass_e;
+
+   #define RETINEX_MAX_SCALES 8
+
+   /**
+    * Parameters of the multiscale retinex. The defaults are those of the Matlab implementation 
+	* (multiScaleRetinex.m): sigmas 15, 80 and 250 with equal weights in a 9x9 window. There the 
+	* kernels are fspecial('gaussian',9,sigma) written out with %f (saveFilterH.m) so with 6 
+	* decimals the kernels are exactly the old RetinexFilt9x9.h tables.
+	*/
+   typedef struct _retinexParams{
+     _retinexParams(): scales(3), window(9), decimals(6){
+       sigma[0] = 15; sigma[1] = 80; sigma[2] = 250;
+       for (int s = 0; s < RETINEX_MAX_SCALES; s++) { weight[s] = 1.0f/3; }
+     };
+
+     int scales;                       ///number of scales (1..RETINEX_MAX_SCALES)
+     float sigma[RETINEX_MAX_SCALES];  ///Gaussian sigma of each scale
+     float weight[RETINEX_MAX_SCALES]; ///weight of each scale in the response
+     int window;                       ///kernel window size (odd) with RETINEX_LP_KERNEL
+     int decimals;                     ///kernel coefficients rounded to decimals (0 not rounded)
+   }retinexParams_t;
+
+   /**
+    * Retinex kernels generated for the parameters. These are made once (eg. at start up) 
+	* and can be used in any number of multiscaleRetinexFilter calls (also in parallel).
+	*/
+   typedef struct _retinexKernels{
+     _retinexKernels(): separable(false){};
+
+     retinexParams_t params;  ///the parameters the kernels were made for
+     std::vector<float> H;    ///2D kernels (window x window) of each scale
+     std::vector<float> Hx;   ///row and column factors of each scale (H = Hy*Hx^T) if separable
+     std::vector<float> Hy;
+     bool separable;          ///all kernels are rank-1 (separateKernel)
+   }retinexKernels_t;
+
+   /**
+    * Generate the retinex kernels (normalised Gaussians of params) and their separable factors
+	* @param ker the kernels (previous kernels are replaced)
+	* @param par the parameters
+	* @return 0 if ok, -2 for invalid parameters
+	*/
+   int retinexKernelsOpen( retinexKernels_t *ker, const retinexParams_t *par );
+
+   /**
+    * Release the memory held by the kernels
+	* @param ker the kernels
+	*/
+   void retinexKernelsRelease( retinexKernels_t *ker );
 
    /**
     * Multiscale Retinex filtering inspired by :
@@ -110,26 +348,184 @@ using namespace commonImage;
     *      the Human Observation of Scenes" Daniel J. Jobson, Zia-ur Rahman, and Glenn A. Woodell
     *      IEEE TRANSACTIONS ON IMAGE PROCESSING, VOL. 6, NO. 7, JULY 1997
 	*	
-	*	filtering parameters are hardcoded as in the above ref. 
+	*	the scales (and the filter windows) are as given in kernels (def. as in the above ref.). 
 	*
 	*  @param input  commonImage_t *image (double)
 	*  @param output commonImage_t *image (double), (re)allocated if no suitable buffer is found at .data
+	*  @param stats  if not NULL stats of output
+	*  @param fastLog use the vectorized log(1+x) approximation (log1pF32 in simdKernels.h, 
+	*                 abs error < 5e-8) instead of logf
+	*  @param lowPass the low pass filters (as multiscaleRetinexFilterGauss if not RETINEX_LP_KERNEL)
+	*  @param kernels the scales and the kernels from retinexKernelsOpen (if NULL the defaults 
+	*                 are generated for this call)
 	*  @return error code, zero if success negative on error 
 	*/   
-	int multiscaleRetinexFilter( commonImage_t *input, commonImage_t *output );
+	int multiscaleRetinexFilter( commonImage_t *input, commonImage_t *output, imageStats_t *stats=NULL, bool fastLog=false, 
+	                             retinexLowPass_e lowPass=RETINEX_LP_KERNEL, const retinexKernels_t *kernels=NULL );
+
+   /**
+    * Multiscale Retinex as multiscaleRetinexFilter but with the true Gaussian scales of the 
+	* reference (sigmas 15, 80 and 250 with equal weights) instead of the 9x9 kernels. The 
+	* Gaussians are computed with gaussianRecursive_Float (full support, image extended 
+	* with border values) so the borders are not zeroed.
+	*
+	*  @param input  commonImage_t *image (Float1D)
+	*  @param output commonImage_t *image (Float1D), (re)allocated if no suitable buffer is found at .data
+	*  @param stats  if not NULL stats of output
+	*  @param fastLog as in multiscaleRetinexFilter
+	*  @return error code, zero if success negative on error 
+	*/   
+	int multiscaleRetinexFilterGauss( commonImage_t *input, commonImage_t *output, imageStats_t *stats=NULL, bool fastLog=false );
+
+   /**
+    * Retinex y-projection gradient feature of the visibility estimation (makeFeatureVector.m):
+	* row sums of the multiscale retinex response over its valid part, absolute differences of
+	* consecutive sums and these normalised with their max. With the kernel low pass the rows 
+	* are summed in the retinex pass, the retinex image is not stored.
+	*
+	*  @param input   commonImage_t *image (Float1D, on range [0 1] as normaliseToDouble.m gives)
+	*  @param feature out: the feature vector, valid rows-1 values (951 for 960 rows and 9x9 kernels,
+	*                 height-1 with the full Gaussians that have no border)
+	*  @param fastLog as in multiscaleRetinexFilter
+	*  @param lowPass as in multiscaleRetinexFilter
+	*  @param kernels as in multiscaleRetinexFilter
+	*  @return error code, zero if success negative on error 
+	*/   
+	int retinexProjectionGradient( commonImage_t *input, std::vector<float> &feature, bool fastLog=false,
+	                               retinexLowPass_e lowPass=RETINEX_LP_KERNEL, const retinexKernels_t *kernels=NULL );
 	
+   /**
+    * How the convolution extends the image over its borders
+    */
+   typedef enum _convBorder{
+     CONV_BORDER_VALID,     /// no extension, only pixels where the kernel fits in the image are written
+     CONV_BORDER_ZERO,      /// zeros outside the image
+     CONV_BORDER_REPLICATE, /// edge pixels repeated:   aaa|abcd|ddd
+     CONV_BORDER_MIRROR     /// mirrored at edge pixel: dcb|abcd|cba
+   } convBorder_e;
+
+   /**
+    * Tiled 2D convolution. The output is split to tiles (def 256x64) that are convolved in 
+	* parallel (parallel.h). Tiles whose halo (Hsize/2 pixels) is inside the image read the 
+	* input directly, the others from a scratch copy extended as given by border. The 
+	* scratch buffers (one per thread) are kept in the engine for the next calls.
+	*
+	* Each output pixel is sum over kernel rows of (sum over kernel columns of H*in) as 
+	* computed by the original convolution2D_Float so the results are the same.
+	*/
+   typedef struct _convEngine{
+     _convEngine(): tileWidth(256), tileHeight(64){};
+
+     int tileWidth;                                  ///output tile size
+     int tileHeight;
+     std::vector< std::vector<float> > scratchF;     ///per thread tile buffers (Float1D)
+     std::vector< std::vector<double> > scratchD;    ///per thread tile buffers (Double1D)
+   }convEngine_t;
+
+   /**
+    * Convolve image with a 2D kernel
+	* @param eng    the engine (scratch buffers reused over calls, do not share between threads)
+	* @param input  image (Float1D with float kernel, Double1D with double kernel)
+	* @param output result of same type and size, (re)allocated if no suitable buffer (not input)
+	* @param H      the kernel (Hsize x Hsize row by row)
+	* @param Hsize  kernel size (odd)
+	* @param border extension of image over borders (with CONV_BORDER_VALID the Hsize/2 pixel
+	*               frame of output is not written)
+	* @return error code, zero if success negative on error (-2 bad input, -3 image smaller 
+	*         than kernel with CONV_BORDER_VALID)
+	*/
+   int convEngineRun( convEngine_t *eng, commonImage_t *input, commonImage_t *output, const float *H, unsigned int Hsize, 
+                      convBorder_e border=CONV_BORDER_REPLICATE );
+   int convEngineRun( convEngine_t *eng, commonImage_t *input, commonImage_t *output, const double *H, unsigned int Hsize, 
+                      convBorder_e border=CONV_BORDER_REPLICATE );
+
+   /**
+    * Release the scratch buffers of engine
+	* @param eng the engine
+	*/
+   void convEngineRelease( convEngine_t *eng );
+
 	/**
-	 * Convolution using variable kernel size
+	 * Convolution using variable kernel size (convEngineRun with CONV_BORDER_VALID)
 	 * 
 	 * @param input 		image of Float 
 	 * @param imgF1 		output image (Float)
 	 * @param H1    		pointer to kernel
 	 * @param Hsize 		kernel size (must be odd) 
 	 * @param zeroBorders   if true set borders outside valid convolution area to 0 
+	 * @param eng           engine whose scratch is reused, if NULL an engine kept in the library 
+	 *                      over calls (a temporary one if it is in use by another thread)
+	 * @return error code, zero if success negative on error 
+	 */
+    int convolution2D_Float(  commonImage_t *input, commonImage_t *imgF1, float *H1, unsigned int Hsize, bool zeroBorders=false,
+	                          convEngine_t *eng=NULL );
+	
+	/**
+	 * As convolution2D_Float for Double1D images, borders outside valid area are set to 0 
+	 */
+	int convolution2D_Double( commonImage_t *input, commonImage_t *imgD1, double *H1, unsigned int Hsize, convEngine_t *eng=NULL );
+
+	/**
+	 * Factor 2D kernel to row and column kernels (H[r][c] = Hy[r]*Hx[c]) if it is
+	 * rank-1 (eg Gaussian) within tolerance
+	 *
+	 * @param H     the kernel (Hsize x Hsize)
+	 * @param Hsize kernel size
+	 * @param Hx    out: row kernel (Hsize values)
+	 * @param Hy    out: column kernel (Hsize values)
+	 * @param tol   largest allowed difference relative to largest kernel value
+	 * @return true if kernel is separable (Hx and Hy set)
+	 */
+	bool separateKernel( const float *H, unsigned int Hsize, float *Hx, float *Hy, float tol=1e-3f );
+	
+	/**
+	 * Separable convolution (row pass with Hx then column pass with Hy), the same
+	 * result as convolution2D_Float with kernel H[r][c] = Hy[r]*Hx[c] within float rounding
+	 * 
+	 * @param input 		image of Float 
+	 * @param output 		output image (Float, same size as input)
+	 * @param Hx    		row kernel
+	 * @param Hy    		column kernel
+	 * @param Hsize 		kernel size (must be odd) 
+	 * @param zeroBorders   if true set borders outside valid convolution area to 0 
+	 * @return error code, zero if success negative on error 
+	 */
+	int convolutionSeparable_Float( commonImage_t *input, commonImage_t *output, const float *Hx, const float *Hy, unsigned int Hsize, bool zeroBorders=false );
+
+	/**
+	 * Gaussian filtering with recursive filters (cost per pixel do not depend on sigma)
+	 *
+	 *  ref: "Recursive implementation of the Gaussian filter" Ian T. Young, Lucas J. van Vliet
+	 *       Signal Processing 44 (1995) 139-151
+	 *
+	 * The image is extended with its border values. The filters run in double (rows in 
+	 * parallel and then columns in parallel bands).
+	 *
+	 * @param input 		image of Float 
+	 * @param output 		output image (Float), (re)allocated if no suitable buffer, can be input
+	 * @param sigma 		standard deviation of the Gaussian (at least 0.5)
 	 * @return error code, zero if success negative on error 
 	 */
-    int convolution2D_Float(  commonImage_t *input, commonImage_t *imgF1, float *H1, unsigned int Hsize, bool zeroBorders=false);
-	int convolution2D_Double( commonImage_t *input, commonImage_t *imgD1, double *H1, unsigned int Hsize );
+	int gaussianRecursive_Float( commonImage_t *input, commonImage_t *output, float sigma );
+
+	/**
+	 * Almost Gaussian filtering with a cascade of box filters (running sums, cost per pixel 
+	 * do not depend on sigma). The box widths are odd and chosen so that the variance of the 
+	 * cascade is closest to sigma^2. With 3 passes the impulse response is piecewise quadratic:
+	 * its peak is 3..6 % lower than that of the Gaussian and the largest difference is 6 % of 
+	 * the peak (sigma 2..250, gaussianRecursive_Float is within 1.2 %).
+	 *
+	 *  ref: "Fast Almost-Gaussian Filtering" Peter Kovesi, DICTA 2010
+	 *
+	 * Each pass extends its input with the edge values. 
+	 *
+	 * @param input 		image of Float 
+	 * @param output 		output image (Float), (re)allocated if no suitable buffer, can be input
+	 * @param sigma 		standard deviation of the Gaussian (at least 0.5)
+	 * @param passes 		number of box filters (1..8)
+	 * @return error code, zero if success negative on error 
+	 */
+	int gaussianBox_Float( commonImage_t *input, commonImage_t *output, float sigma, int passes=3 );
          
 	/**
 	 * Set border values
@@ -143,6 +539,13 @@ using namespace commonImage;
    
    
 
-	double totalSum( commonImage_t *input );
+	/**
+	 * Sum of pixel values
+	 *
+	 * @param input image
+	 * @param stats if valid stats of input the sum is taken from it
+	 * @return the sum
+	 */
+	double totalSum( commonImage_t *input, const imageStats_t *stats=NULL );
    
 #endif // IMAGEPROCESSING_H
\ No newline at end of file
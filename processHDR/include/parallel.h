@@ -0,0 +1,74 @@
+/**
+ * @file parallel.h
+ *
+ * @section DESCRIPTION
+ *
+ * A small worker pool (pthreads) for splitting image processing tasks over
+ * several cores. The pool threads are started at the first parallel call and
+ * reused after that. By default everything is run in the calling thread.
+ *
+ * If a parallel call is made while the pool is busy (eg from a pool task or
+ * from another thread) the tasks are run serially in the calling thread.
+ *
+ * API: setThreadCount, getThreadCount, parallelFor, parallelRows, parallelWorkers
+ *
+ * @author Sami Varjo 2014
+ *
+ **************************************************************************/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+  /**
+   * Task run for each id in parallelFor
+   */
+  typedef void (*parallelTask_t)( int id, void *ctx );
+
+  /**
+   * Task run for a band of rows [rowStart, rowEnd) in parallelRows
+   */
+  typedef void (*rowBandTask_t)( int rowStart, int rowEnd, void *ctx );
+
+  /**
+   * Task run for each id in parallelWorkers (worker is the index of the running thread)
+   */
+  typedef void (*workerTask_t)( int worker, int id, void *ctx );
+
+  /**
+   * Set the number of threads used (including the calling thread)
+   * @param n number of threads, 1 for serial processing (def), 0 or negative for all cores
+   */
+  void setThreadCount( int n );
+
+  /**
+   * @return the number of threads in use
+   */
+  int getThreadCount();
+
+  /**
+   * Run task for ids 0..nTasks-1 using the pool. Returns when all tasks are done.
+   * The ids are handed out in increasing order but can be run in any order.
+   * @param nTasks number of tasks
+   * @param task   function to be called for each id
+   * @param ctx    passed to task as is
+   */
+  void parallelFor( int nTasks, parallelTask_t task, void *ctx );
+
+  /**
+   * Split rows 0..rows-1 to one contiguous band per thread and run task for each band.
+   * @param rows number of rows (eg image height)
+   * @param task function to be called for each band
+   * @param ctx  passed to task as is
+   */
+  void parallelRows( int rows, rowBandTask_t task, void *ctx );
+
+  /**
+   * As parallelFor but the task gets also the index of the worker running it (0..getThreadCount()-1).
+   * A worker runs one task at a time so per worker buffers can be used in the tasks.
+   * @param nTasks number of tasks
+   * @param task   function to be called for each id
+   * @param ctx    passed to task as is
+   */
+  void parallelWorkers( int nTasks, workerTask_t task, void *ctx );
+
+#endif // PARALLEL_H
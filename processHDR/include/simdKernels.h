@@ -0,0 +1,144 @@
+/**
+ * @file simdKernels.h
+ *
+ * @section DESCRIPTION
+ *
+ * Explicitly vectorized inner loops for the image processing functions.
+ * Each kernel has a plain C version and versions for the supported
+ * instruction sets which are compiled in separate files with their own
+ * compiler flags (see Makefile). The best version supported by the running
+ * cpu is selected at runtime.
+ *
+ * The vectorized versions give bit identical results with the plain C
+ * versions (no fused multiply-add is used so the rounding is the same).
+ *
+ * API: getSimdLevel, setSimdLevel, simdLevelName, addWeightedU16, addScaledU16, minMaxF32,
+ *      log1pF32, claheBlendU16
+ *
+ * @author Sami Varjo 2014
+ *
+ **************************************************************************/
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stdint.h>
+
+  /**
+   * The instruction set levels having kernels
+   */
+  typedef enum _simdLevel{
+    SIMD_NONE,   /// plain C
+    SIMD_SSE41,  /// SSE 4.1
+    SIMD_AVX2    /// AVX2
+  } simdLevel_e;
+
+  /**
+   * @return the level in use (by default the best supported by cpu)
+   */
+  simdLevel_e getSimdLevel();
+
+  /**
+   * Limit the level in use (eg for testing), levels not supported by cpu are ignored
+   * @param level the highest level to be used
+   */
+  void setSimdLevel( simdLevel_e level );
+
+  /**
+   * @return printable name of the level
+   */
+  const char* simdLevelName( simdLevel_e level );
+
+  /**
+   * Exposure time weighted accumulation of 16 bit data: out[i] += in[i]*weight
+   * @param in     16 bit input pixels
+   * @param weight the weight (exposure time)
+   * @param out    float sum buffer
+   * @param count  number of pixels
+   */
+  void addWeightedU16( const unsigned short *in, float weight, float *out, int count );
+
+  //Instruction set specific versions (use the above instead)
+  void addWeightedU16_C( const unsigned short *in, float weight, float *out, int count );
+  void addWeightedU16_SSE41( const unsigned short *in, float weight, float *out, int count );
+  void addWeightedU16_AVX2( const unsigned short *in, float weight, float *out, int count );
+
+  /**
+   * Exact integer accumulation of 16 bit data: out[i] += in[i]*weight
+   * @param in     16 bit input pixels
+   * @param weight the weight (integer exposure time)
+   * @param out    64 bit sum buffer
+   * @param count  number of pixels
+   */
+  void addScaledU16( const unsigned short *in, uint32_t weight, uint64_t *out, int count );
+
+  //Instruction set specific versions (use the above instead)
+  void addScaledU16_C( const unsigned short *in, uint32_t weight, uint64_t *out, int count );
+  void addScaledU16_SSE41( const unsigned short *in, uint32_t weight, uint64_t *out, int count );
+  void addScaledU16_AVX2( const unsigned short *in, uint32_t weight, uint64_t *out, int count );
+
+  /**
+   * Min and max of float data: minVal = in[i] < minVal ? in[i] : minVal (max similarly)
+   * so NaN values are skipped.
+   * @param in     input data
+   * @param count  number of values
+   * @param minVal in: initial min, out: the min
+   * @param maxVal in: initial max, out: the max
+   */
+  void minMaxF32( const float *in, int count, float *minVal, float *maxVal );
+
+  //Instruction set specific versions (use the above instead)
+  void minMaxF32_C( const float *in, int count, float *minVal, float *maxVal );
+  void minMaxF32_SSE41( const float *in, int count, float *minVal, float *maxVal );
+  void minMaxF32_AVX2( const float *in, int count, float *minVal, float *maxVal );
+
+  /**
+   * Fast natural logarithm of 1+x: out[i] = log(1+in[i]) where 1+in[i] is rounded to
+   * float first (as in logf(1+x)). Range reduction to mantissa [sqrt(0.5), sqrt(2)) and
+   * a 9th degree polynomial (Cephes logf).
+   * Max abs error to log(1+x) of the rounded 1+x is 5e-8 for x in [0 1] (logf 3e-8),
+   * relative error 1e-7 for larger x (measured 3.9e-8 and 8.1e-8, see bench/benchLog1p.cpp).
+   * Input has to be finite and 1+in[i] a positive normal float (no checks).
+   * @param in     input data (can be out)
+   * @param out    log(1+in)
+   * @param count  number of values
+   */
+  void log1pF32( const float *in, float *out, int count );
+
+  //Instruction set specific versions (use the above instead)
+  void log1pF32_C( const float *in, float *out, int count );
+  void log1pF32_SSE41( const float *in, float *out, int count );
+  void log1pF32_AVX2( const float *in, float *out, int count );
+
+  /**
+   * CLAHE bilinear interpolation of the four region mappings on a row of a sub-block of
+   * width pixels (Interpolate in clahe.cpp) for the pixels i = first..width-1:
+   *   b = lut[in[i]]
+   *   out[i] = (yInvCoef*((width-i)*mapLU[b] + i*mapRU[b]) + yCoef*((width-i)*mapLB[b] + i*mapRB[b])) / num
+   * The integer division is done with a float reciprocal and one correction step, the
+   * result is exact when the sums stay below 2^31 (num times the largest mapping < 2^31).
+   * @param in     16 bit input pixels of the row (can be out)
+   * @param out    the interpolated pixels
+   * @param first  first pixel of the row processed
+   * @param width  sub-block width
+   * @param lut    bins of the input values
+   * @param mapLU  mapping of the left upper region (and mapRU, mapLB, mapRB)
+   * @param yCoef  distance of the row from the upper mappings (yInvCoef from the lower)
+   * @param num    normalisation (sub-block width*height)
+   */
+  void claheBlendU16( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                      const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                      uint32_t yCoef, uint32_t yInvCoef, uint32_t num );
+
+  //Instruction set specific versions (use the above instead)
+  void claheBlendU16_C( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                        const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                        uint32_t yCoef, uint32_t yInvCoef, uint32_t num );
+  void claheBlendU16_SSE41( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                            const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                            uint32_t yCoef, uint32_t yInvCoef, uint32_t num );
+  void claheBlendU16_AVX2( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                           const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                           uint32_t yCoef, uint32_t yInvCoef, uint32_t num );
+
+#endif // SIMD_KERNELS_H
@@ -0,0 +1,99 @@
+/**
+ * @file stackPipeline.h
+ *
+ * @section DESCRIPTION
+ *
+ * Decoding of stack images ahead of their use (producer/consumer). The decode
+ * threads read the images in increasing id order into a small fixed set of
+ * frame buffers and the consumer (eg the stacking loop) takes them in id order
+ * and gives the buffer back when done with it. So the image decoding (eg LZW
+ * in TIFF) and the processing of already decoded images run at the same time.
+ *
+ * With zero decode threads the image is decoded when asked (no threads).
+ *
+ * Usage: start -> (get -> recycle) for ids 0..N-1 -> stop
+ *
+ * API: stackPipelineStart, stackPipelineGet, stackPipelineRecycle, stackPipelineLimit,
+ *      stackPipelineStop, stackPipelineRelease
+ *
+ * @author Sami Varjo 2014
+ *
+ **************************************************************************/
+
+#ifndef STACK_PIPELINE_H
+#define STACK_PIPELINE_H
+
+#include <vector>
+#include "commonImage.h"
+
+using namespace commonImage;
+
+  /**
+   * Decode image id of the stack into frame (the frame buffer is reused if possible)
+   * @return error code, zero if success negative on error
+   */
+  typedef int (*frameDecoder_t)( int id, commonImage_t *frame, void *ctx );
+
+  /**
+   * The pipeline state. The frame buffers are kept over stacks (freed in stackPipelineRelease).
+   */
+  typedef struct _stackPipeline{
+    _stackPipeline(): nFrames(0), decoders(0), decode(NULL), ctx(NULL), sync(NULL){};
+
+    std::vector<commonImage_t> frames; ///the recycled frame buffers
+    std::vector<int> slotId;           ///image id in each buffer (-1 if free)
+    std::vector<int> slotState;        ///decoding, ready or failed
+    int nFrames;                       ///number of images in stack
+    int decoders;                      ///number of decode threads
+    frameDecoder_t decode;
+    void *ctx;
+    void *sync;                        ///threads and locks (internal)
+  }stackPipeline_t;
+
+  /**
+   * Start decoding a new stack
+   * @param pipe     the pipeline
+   * @param nFrames  number of images in stack (ids 0..nFrames-1)
+   * @param decoders number of decode threads (0 decode in stackPipelineGet)
+   * @param buffers  number of frame buffers (at least decoders+1)
+   * @param decode   function decoding one image
+   * @param ctx      passed to decode as is
+   * @return error code, zero if success negative on error
+   */
+  int stackPipelineStart( stackPipeline_t *pipe, int nFrames, int decoders, int buffers, frameDecoder_t decode, void *ctx );
+
+  /**
+   * Wait for image id (ask ids in increasing order)
+   * @param pipe the pipeline
+   * @param id   image id
+   * @return the decoded image or NULL if decoding failed
+   */
+  commonImage_t* stackPipelineGet( stackPipeline_t *pipe, int id );
+
+  /**
+   * Give the buffer of image id back for decoding next images
+   * @param pipe the pipeline
+   * @param id   image id (as given to stackPipelineGet)
+   */
+  void stackPipelineRecycle( stackPipeline_t *pipe, int id );
+
+  /**
+   * Images after lastId are not needed (decoding is stopped at lastId)
+   * @param pipe   the pipeline
+   * @param lastId the last image that will be asked
+   */
+  void stackPipelineLimit( stackPipeline_t *pipe, int lastId );
+
+  /**
+   * Stop decoding and wait the decode threads to end (images not asked are discarded)
+   * @param pipe the pipeline
+   */
+  void stackPipelineStop( stackPipeline_t *pipe );
+
+  /**
+   * Release the frame buffers
+   * @param pipe the pipeline (stopped)
+   */
+  void stackPipelineRelease( stackPipeline_t *pipe );
+
+#endif // STACK_PIPELINE_H
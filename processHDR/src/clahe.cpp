@@ -1,11 +1,18 @@
 #include "clahe.h"
 #include <stdlib.h>			 /* To get prototypes of malloc() and free() */
+#include <string.h>			 /* memset() */
 #include <iostream>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "parallel.h"
+#include "simdKernels.h"
 
 /************************** main function CLAHE ******************/
 int Clahe (kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes,
 	 kz_pixel_t Min, kz_pixel_t Max, unsigned int uiNrX, unsigned int uiNrY,
-	      unsigned int uiNrBins, float fCliplimit)
+	      unsigned int uiNrBins, float fCliplimit, unsigned long* pulOutHist)
 /*   pImage - Pointer to the input/output image
  *   uiXRes - Image resolution in the X direction
  *   uiYRes - Image resolution in the Y direction
@@ -15,6 +22,8 @@ int Clahe (kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes,
  *   uiNrY - Number of contextial regions in the Y direction (min 2, max uiMAX_REG_Y)
  *   uiNrBins - Number of greybins for histogram ("dynamic range")
  *   float fCliplimit - Normalized cliplimit (higher values give more contrast)
+ *   pulOutHist - if not NULL, histogram of output image (uiNR_OF_GREY bins) counted as
+ *		 the pixels are written (left empty if the image is returned as is)
  * The number of "effective" greylevels in the output image is set by uiNrBins; selecting
  * a small value (eg. 128) speeds up processing and still produce an output image of
  * good quality. The output image will have the same minimum and maximum value as the input
@@ -39,6 +48,7 @@ int Clahe (kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes,
     #endif
     if (Min >= Max) return -6;		  /* minimum equal or larger than maximum */
     if (uiNrX < 2 || uiNrY < 2) return -7;/* at least 4 contextual regions required */
+    if (pulOutHist) memset(pulOutHist, 0, sizeof(unsigned long)*uiNR_OF_GREY);
     if (fCliplimit == 1.0) return 0;	  /* is OK, immediately returns original image. */
     if (uiNrBins == 0) uiNrBins = 128;	  /* default value when not specified */
 
@@ -98,7 +108,7 @@ int Clahe (kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes,
 	    pulRU = &pulMapArray[uiNrBins * (uiYU * uiNrX + uiXR)];
 	    pulLB = &pulMapArray[uiNrBins * (uiYB * uiNrX + uiXL)];
 	    pulRB = &pulMapArray[uiNrBins * (uiYB * uiNrX + uiXR)];
-	    Interpolate(pImPointer,uiXRes,pulLU,pulRU,pulLB,pulRB,uiSubX,uiSubY,aLUT);
+	    Interpolate(pImPointer,uiXRes,pulLU,pulRU,pulLB,pulRB,uiSubX,uiSubY,aLUT,pulOutHist);
 	    pImPointer += uiSubX;			  /* set pointer on next matrix */
 	}
 	pImPointer += (uiSubY - 1) * uiXRes;
@@ -201,6 +211,54 @@ void MakeHistogram (kz_pixel_t* pImage, unsigned int uiXRes,
 	*/
 }
 
+template <typename T, typename BinOf>
+static inline void CountCopies (const T* pPixel, unsigned int uiCount, const BinOf& binOf,
+		unsigned long* pulCopies, unsigned int uiNrGreylevels)
+/* Counts the bins of uiCount pixels, pixel i to copy i % uiHIST_COPIES of the histogram */
+{
+    unsigned long* pul0 = pulCopies, *pul1 = pul0 + uiNrGreylevels;
+    unsigned long* pul2 = pul1 + uiNrGreylevels, *pul3 = pul2 + uiNrGreylevels;
+    const T* pEnd = pPixel + uiCount;
+
+    for (; pPixel + 4 <= pEnd; pPixel += 4) {
+	pul0[binOf(pPixel[0])]++; pul1[binOf(pPixel[1])]++;
+	pul2[binOf(pPixel[2])]++; pul3[binOf(pPixel[3])]++;
+    }
+    for (; pPixel < pEnd; pPixel++) pul0[binOf(*pPixel)]++;
+}
+
+static void SumCopies (const unsigned long* pulCopies, unsigned int uiNrGreylevels, unsigned long* pulHistogram)
+/* The histogram from its uiHIST_COPIES copies */
+{
+    for (unsigned int i = 0; i < uiNrGreylevels; i++) {
+	unsigned long ulSum = 0;
+	for (unsigned int c = 0; c < uiHIST_COPIES; c++) ulSum += pulCopies[c*uiNrGreylevels + i];
+	pulHistogram[i] = ulSum;
+    }
+}
+
+struct claheLutBin{
+    const kz_pixel_t* pLUT;
+    unsigned int operator() (kz_pixel_t value) const { return pLUT[value]; }
+};
+
+void MakeHistogramCopies (kz_pixel_t* pImage, unsigned int uiXRes,
+		unsigned int uiSizeX, unsigned int uiSizeY,
+		unsigned long* pulHistogram,
+		unsigned int uiNrGreylevels, kz_pixel_t* pLookupTable, unsigned long* pulCopies)
+/* As MakeHistogram. Runs of equal bins are common in images, counted in one histogram each
+ * increment would have to wait for the previous one to be stored. */
+{
+    claheLutBin binOf;
+    binOf.pLUT = pLookupTable;
+
+    memset(pulCopies, 0, sizeof(unsigned long)*uiHIST_COPIES*uiNrGreylevels);
+    for (unsigned int i = 0; i < uiSizeY; i++, pImage += uiXRes) {
+	CountCopies(pImage, uiSizeX, binOf, pulCopies, uiNrGreylevels);
+    }
+    SumCopies(pulCopies, uiNrGreylevels, pulHistogram);
+}
+
 void MapHistogram (unsigned long* pulHistogram, kz_pixel_t Min, kz_pixel_t Max,
 	       unsigned int uiNrGreylevels, unsigned long ulNrOfPixels)
 /* This function calculates the equalized lookup table (mapping) by
@@ -230,13 +288,14 @@ void MakeLut (kz_pixel_t * pLUT, kz_pixel_t Min, kz_pixel_t Max, unsigned int ui
 
 void Interpolate (kz_pixel_t * pImage, int uiXRes, unsigned long * pulMapLU,
      unsigned long * pulMapRU, unsigned long * pulMapLB,  unsigned long * pulMapRB,
-     unsigned int uiXSize, unsigned int uiYSize, kz_pixel_t * pLUT)
+     unsigned int uiXSize, unsigned int uiYSize, kz_pixel_t * pLUT, unsigned long * pulOutHist)
 /* pImage      - pointer to input/output image
  * uiXRes      - resolution of image in x-direction
  * pulMap*     - mappings of greylevels from histograms
  * uiXSize     - uiXSize of image submatrix
  * uiYSize     - uiYSize of image submatrix
  * pLUT	       - lookup table containing mapping greyvalues to bins
+ * pulOutHist  - histogram of output greyvalues to be updated (or NULL)
  * This function calculates the new greylevel assignments of pixels within a submatrix
  * of the image with size uiXSize and uiYSize. This is done by a bilinear interpolation
  * between four different mappings in order to eliminate boundary artifacts.
@@ -255,10 +314,12 @@ void Interpolate (kz_pixel_t * pImage, int uiXRes, unsigned long * pulMapLU,
 	for (uiXCoef = 0, uiXInvCoef = uiXSize; uiXCoef < uiXSize;
 	     uiXCoef++, uiXInvCoef--) {
 	    GreyValue = pLUT[*pImage];		   /* get histogram bin value */
-	    *pImage++ = (kz_pixel_t ) ((uiYInvCoef * (uiXInvCoef*pulMapLU[GreyValue]
+	    *pImage = (kz_pixel_t ) ((uiYInvCoef * (uiXInvCoef*pulMapLU[GreyValue]
 				      + uiXCoef * pulMapRU[GreyValue])
 				+ uiYCoef * (uiXInvCoef * pulMapLB[GreyValue]
 				      + uiXCoef * pulMapRB[GreyValue])) / uiNum);
+	    if (pulOutHist) pulOutHist[*pImage]++;
+	    pImage++;
 	}
     }
     else {			   /* avoid the division and use a right shift instead */
@@ -268,11 +329,497 @@ void Interpolate (kz_pixel_t * pImage, int uiXRes, unsigned long * pulMapLU,
 	     for (uiXCoef = 0, uiXInvCoef = uiXSize; uiXCoef < uiXSize;
 	       uiXCoef++, uiXInvCoef--) {
 	       GreyValue = pLUT[*pImage];	  /* get histogram bin value */
-	       *pImage++ = (kz_pixel_t)((uiYInvCoef* (uiXInvCoef * pulMapLU[GreyValue]
+	       *pImage = (kz_pixel_t)((uiYInvCoef* (uiXInvCoef * pulMapLU[GreyValue]
 				      + uiXCoef * pulMapRU[GreyValue])
 				+ uiYCoef * (uiXInvCoef * pulMapLB[GreyValue]
 				      + uiXCoef * pulMapRB[GreyValue])) >> uiShift);
+	       if (pulOutHist) pulOutHist[*pImage]++;
+	       pImage++;
 	    }
 	}
     }
 }
+
+#ifndef IMAGE_8_BIT
+void InterpolateRows (kz_pixel_t * pImage, int uiXRes, const uint32_t * puiMapLU,
+     const uint32_t * puiMapRU, const uint32_t * puiMapLB, const uint32_t * puiMapRB,
+     unsigned int uiXSize, unsigned int uiYSize, const uint32_t * puiLUT, unsigned long * pulOutHist)
+/* As Interpolate, the division by uiNum is done with a reciprocal in claheBlendU16 */
+{
+    const unsigned int uiNum = uiXSize*uiYSize;
+
+    for (unsigned int uiYCoef = 0, uiYInvCoef = uiYSize; uiYCoef < uiYSize;
+	 uiYCoef++, uiYInvCoef--, pImage += uiXRes) {
+	claheBlendU16(pImage, pImage, 0, uiXSize, puiLUT, puiMapLU, puiMapRU, puiMapLB, puiMapRB,
+		      uiYCoef, uiYInvCoef, uiNum);
+	if (pulOutHist) {
+	    for (unsigned int x = 0; x < uiXSize; x++) pulOutHist[pImage[x]]++;
+	}
+    }
+}
+#endif
+
+/************************** parallel CLAHE ******************/
+typedef struct _claheJob{
+    kz_pixel_t* pImage;
+    unsigned int uiXRes;
+    unsigned int uiNrX, uiNrY;		   /* number of contextual regions */
+    unsigned int uiXSize, uiYSize;	   /* size of contextual regions */
+    unsigned int uiNrBins;
+    kz_pixel_t Min, Max;
+    unsigned long ulClipLimit, ulNrPixels;
+    kz_pixel_t* pLUT;
+    unsigned long* pulMapArray;		   /* mappings of the regions */
+    unsigned long* pulWorkerHist;	   /* output histograms of the workers (or NULL) */
+    unsigned long* pulWorkerCopies;	   /* histogram copies of the workers (MakeHistogramCopies) */
+    uint32_t* puiLUT;			   /* pLUT and the mappings in 32 bits for InterpolateRows */
+    uint32_t* puiMapArray;		   /* (NULL if the mappings do not fit, Interpolate used) */
+}claheJob_t;
+
+static void ClaheRegionTask (int worker, int id, void* ctx)
+/* Histogram, clipping and mapping of contextual region id (row major) */
+{
+    claheJob_t* pJob = (claheJob_t*)ctx;
+    unsigned int uiX = id % (*pJob).uiNrX, uiY = id / (*pJob).uiNrX;
+    kz_pixel_t* pImPointer = (*pJob).pImage + uiY*(*pJob).uiYSize*(*pJob).uiXRes + uiX*(*pJob).uiXSize;
+    unsigned long* pulHist = &(*pJob).pulMapArray[(*pJob).uiNrBins * id];
+    unsigned long* pulCopies = (*pJob).pulWorkerCopies + worker*uiHIST_COPIES*(*pJob).uiNrBins;
+
+    MakeHistogramCopies(pImPointer,(*pJob).uiXRes,(*pJob).uiXSize,(*pJob).uiYSize,pulHist,(*pJob).uiNrBins,(*pJob).pLUT,pulCopies);
+    ClipHistogram(pulHist, (*pJob).uiNrBins, (*pJob).ulClipLimit);
+    MapHistogram(pulHist, (*pJob).Min, (*pJob).Max, (*pJob).uiNrBins, (*pJob).ulNrPixels);
+    if ((*pJob).puiMapArray) {
+	uint32_t* puiMap = &(*pJob).puiMapArray[(*pJob).uiNrBins * id];
+	for (unsigned int i = 0; i < (*pJob).uiNrBins; i++) puiMap[i] = (uint32_t)pulHist[i];
+    }
+}
+
+typedef struct _claheSubBlock{
+    unsigned long ulOffset;		   /* first pixel of the sub-block in image */
+    unsigned int uiSubX, uiSubY;	   /* size of the sub-block */
+    unsigned int uiLU, uiRU, uiLB, uiRB;   /* regions (row major) of the mappings */
+}claheSubBlock_t;
+
+static bool ClaheSubBlock (unsigned int id, unsigned int uiXRes, unsigned int uiNrX, unsigned int uiNrY,
+	unsigned int uiXSize, unsigned int uiYSize, claheSubBlock_t* pBlock)
+/* Sub-block id of the (uiNrX+1)x(uiNrY+1) sub-blocks interpolated in Clahe,
+ * returns false for an empty sub-block */
+{
+    unsigned int uiX = id % (uiNrX+1), uiY = id / (uiNrX+1);
+    unsigned int uiSubX, uiSubY, uiXL, uiXR, uiYU, uiYB, uiX0, uiY0;
+
+    if (uiY == 0) {			   /* top row */
+	uiSubY = uiYSize >> 1;  uiYU = 0; uiYB = 0; uiY0 = 0;
+    }
+    else {
+	uiY0 = (uiYSize >> 1) + (uiY-1)*uiYSize;
+	if (uiY == uiNrY) { uiSubY = uiYSize >> 1; uiYU = uiNrY-1; uiYB = uiYU; }  /* bottom row */
+	else              { uiSubY = uiYSize; uiYU = uiY - 1; uiYB = uiYU + 1; }
+    }
+    if (uiX == 0) {			   /* left column */
+	uiSubX = uiXSize >> 1; uiXL = 0; uiXR = 0; uiX0 = 0;
+    }
+    else {
+	uiX0 = (uiXSize >> 1) + (uiX-1)*uiXSize;
+	if (uiX == uiNrX) { uiSubX = uiXSize >> 1; uiXL = uiNrX - 1; uiXR = uiXL; }  /* right column */
+	else              { uiSubX = uiXSize; uiXL = uiX - 1; uiXR = uiXL + 1; }
+    }
+    if (uiSubX == 0 || uiSubY == 0) return false;
+
+    /* Clahe steps the image pointer by the sub-block widths, with odd uiXSize one pixel
+     * short of a line per sub-block row, the same pixels are used here */
+    unsigned int uiShort = uiXRes - 2*(uiXSize >> 1) - (uiNrX-1)*uiXSize;
+    (*pBlock).ulOffset = (unsigned long)uiY0*uiXRes - uiY*uiShort + uiX0;
+    (*pBlock).uiSubX = uiSubX; (*pBlock).uiSubY = uiSubY;
+    (*pBlock).uiLU = uiYU * uiNrX + uiXL; (*pBlock).uiRU = uiYU * uiNrX + uiXR;
+    (*pBlock).uiLB = uiYB * uiNrX + uiXL; (*pBlock).uiRB = uiYB * uiNrX + uiXR;
+    return true;
+}
+
+static void ClaheInterpolateTask (int worker, int id, void* ctx)
+/* Interpolation of sub-block id (as in Clahe) */
+{
+    claheJob_t* pJob = (claheJob_t*)ctx;
+    claheSubBlock_t block;
+    if (!ClaheSubBlock(id, (*pJob).uiXRes, (*pJob).uiNrX, (*pJob).uiNrY, (*pJob).uiXSize, (*pJob).uiYSize, &block)) return;
+
+    unsigned long* pulMapArray = (*pJob).pulMapArray;
+    unsigned int uiNrBins = (*pJob).uiNrBins;
+    unsigned long* pulOutHist = (*pJob).pulWorkerHist ? (*pJob).pulWorkerHist + worker*uiNR_OF_GREY : 0;
+#ifndef IMAGE_8_BIT
+    const uint32_t* puiMapArray = (*pJob).puiMapArray;
+    if (puiMapArray) {
+	InterpolateRows((*pJob).pImage + block.ulOffset, (*pJob).uiXRes,
+		&puiMapArray[uiNrBins * block.uiLU], &puiMapArray[uiNrBins * block.uiRU],
+		&puiMapArray[uiNrBins * block.uiLB], &puiMapArray[uiNrBins * block.uiRB],
+		block.uiSubX, block.uiSubY, (*pJob).puiLUT, pulOutHist);
+	return;
+    }
+#endif
+    Interpolate((*pJob).pImage + block.ulOffset, (*pJob).uiXRes,
+		&pulMapArray[uiNrBins * block.uiLU], &pulMapArray[uiNrBins * block.uiRU],
+		&pulMapArray[uiNrBins * block.uiLB], &pulMapArray[uiNrBins * block.uiRB],
+		block.uiSubX, block.uiSubY, (*pJob).pLUT, pulOutHist);
+}
+
+int ClaheParallel (kz_pixel_t* pImage, unsigned int uiXRes, unsigned int uiYRes,
+	 kz_pixel_t Min, kz_pixel_t Max, unsigned int uiNrX, unsigned int uiNrY,
+	      unsigned int uiNrBins, float fCliplimit, unsigned long* pulOutHist)
+/* Parameters and return values as in Clahe */
+{
+    kz_pixel_t aLUT[uiNR_OF_GREY];	    /* lookup table used for scaling of input image */
+    claheJob_t job;
+    int iWorkers = getThreadCount();
+
+    if (uiNrX > uiMAX_REG_X) return -1;	   /* # of regions x-direction too large */
+    if (uiNrY > uiMAX_REG_Y) return -2;	   /* # of regions y-direction too large */
+    if (uiXRes % uiNrX) return -3;	  /* x-resolution no multiple of uiNrX */
+    if (uiYRes % uiNrY) return -4;	  /* y-resolution no multiple of uiNrY */
+    if (Min >= Max) return -6;		  /* minimum equal or larger than maximum */
+    if (uiNrX < 2 || uiNrY < 2) return -7;/* at least 4 contextual regions required */
+    if (pulOutHist) memset(pulOutHist, 0, sizeof(unsigned long)*uiNR_OF_GREY);
+    if (fCliplimit == 1.0) return 0;	  /* is OK, immediately returns original image. */
+    if (uiNrBins == 0) uiNrBins = 128;	  /* default value when not specified */
+
+    /* the 32 bit interpolation if the sums of the mappings fit (Max < uiNR_OF_GREY) */
+    bool bRows = false;
+#ifndef IMAGE_8_BIT
+    bRows = (unsigned long)(uiXRes/uiNrX) * (uiYRes/uiNrY) * uiNR_OF_GREY < (1UL<<31);
+#endif
+    job.pulMapArray = (unsigned long *)malloc(sizeof(unsigned long)*uiNrX*uiNrY*uiNrBins);
+    job.pulWorkerHist = pulOutHist ? (unsigned long *)calloc(iWorkers*uiNR_OF_GREY, sizeof(unsigned long)) : 0;
+    job.pulWorkerCopies = (unsigned long *)malloc(sizeof(unsigned long)*iWorkers*uiHIST_COPIES*uiNrBins);
+    job.puiLUT = bRows ? (uint32_t *)calloc(uiNR_OF_GREY, sizeof(uint32_t)) : 0;
+    job.puiMapArray = bRows ? (uint32_t *)malloc(sizeof(uint32_t)*uiNrX*uiNrY*uiNrBins) : 0;
+    if (job.pulMapArray == 0 || (pulOutHist && job.pulWorkerHist == 0) || job.pulWorkerCopies == 0 ||
+	(bRows && (job.puiLUT == 0 || job.puiMapArray == 0))) {
+	free(job.pulMapArray);
+	free(job.pulWorkerHist);
+	free(job.pulWorkerCopies);
+	free(job.puiLUT);
+	free(job.puiMapArray);
+	return -8;			  /* Not enough memory! (try reducing uiNrBins) */
+    }
+
+    job.pImage = pImage;
+    job.uiXRes = uiXRes;
+    job.uiNrX = uiNrX; job.uiNrY = uiNrY;
+    job.uiXSize = uiXRes/uiNrX; job.uiYSize = uiYRes/uiNrY;
+    job.uiNrBins = uiNrBins;
+    job.Min = Min; job.Max = Max;
+    job.ulNrPixels = (unsigned long)job.uiXSize * (unsigned long)job.uiYSize;
+    if(fCliplimit > 0.0) {		  /* Calculate actual cliplimit	 */
+       job.ulClipLimit = (unsigned long) (fCliplimit * (job.uiXSize * job.uiYSize) / uiNrBins);
+       job.ulClipLimit = (job.ulClipLimit < 1UL) ? 1UL : job.ulClipLimit;
+    }
+    else job.ulClipLimit = 1UL<<14;	  /* Large value, do not clip (AHE) */
+    MakeLut(aLUT, Min, Max, uiNrBins);
+    job.pLUT = aLUT;
+    if (bRows) {
+	for (unsigned int i = Min; i <= Max; i++) job.puiLUT[i] = aLUT[i];
+    }
+
+    parallelWorkers(uiNrX*uiNrY, ClaheRegionTask, &job);
+    parallelWorkers((uiNrX+1)*(uiNrY+1), ClaheInterpolateTask, &job);
+
+    if (pulOutHist) {
+	for (int w = 0; w < iWorkers; w++) {
+	    const unsigned long* pulHist = job.pulWorkerHist + w*uiNR_OF_GREY;
+	    for (unsigned int i = 0; i < uiNR_OF_GREY; i++) pulOutHist[i] += pulHist[i];
+	}
+    }
+    free(job.pulWorkerHist);
+    free(job.pulWorkerCopies);
+    free(job.puiLUT);
+    free(job.puiMapArray);
+    free(job.pulMapArray);
+    return 0;
+}
+
+/************************** templated CLAHE ******************/
+template <typename T> struct claheMapType { typedef unsigned long type; }; /* mappings as in Clahe */
+template <> struct claheMapType<float> { typedef float type; };
+
+template <typename T>
+struct claheJobT{
+    typedef typename claheMapType<T>::type map_t;
+    T* pImage;
+    unsigned int uiXRes, uiYRes;
+    unsigned int uiNrX, uiNrY;
+    unsigned int uiXSize, uiYSize;	   /* regions cover uiNrX*uiXSize x uiNrY*uiYSize (virtual padding) */
+    unsigned int uiNrBins;
+    T Min, Max;
+    unsigned long ulClipLimit, ulNrPixels;
+    const unsigned int* puiLUT;		   /* bins of integer values */
+    float fBinScale;			   /* bins per unit for float values */
+    unsigned long* pulWorkerHist;	   /* histogram of each worker (uiNrBins) */
+    map_t* pMapArray;			   /* mappings of the regions */
+    imageStats_t* pBlockStats;		   /* output stats of each sub-block (or NULL) */
+};
+
+template <typename T>
+static inline unsigned int ClaheBin (const claheJobT<T>* pJob, T value)
+{
+    return (*pJob).puiLUT[value];
+}
+
+template <>
+inline unsigned int ClaheBin (const claheJobT<float>* pJob, float value)
+{
+    float fBin = (value - (*pJob).Min) * (*pJob).fBinScale;
+    if (!(fBin > 0)) return 0;		  /* also NaN */
+    unsigned int uiBin = (unsigned int)fBin;
+    return (uiBin < (*pJob).uiNrBins) ? uiBin : (*pJob).uiNrBins-1;
+}
+
+template <typename T>
+struct claheJobBin{
+    const claheJobT<T>* pJob;
+    unsigned int operator() (T value) const { return ClaheBin(pJob, value); }
+};
+
+/* the mapping buffers of the work area (grown when needed) */
+static unsigned long* ClaheMapBuffer (claheWork_t* pWork, size_t size, unsigned long*)
+{
+    if ((*pWork).ulMaps.size() < size) (*pWork).ulMaps.resize(size);
+    return &(*pWork).ulMaps[0];
+}
+
+static float* ClaheMapBuffer (claheWork_t* pWork, size_t size, float*)
+{
+    if ((*pWork).fMaps.size() < size) (*pWork).fMaps.resize(size);
+    return &(*pWork).fMaps[0];
+}
+
+/* bins of integer values as MakeLut but over the whole range of T (float data is binned by scaling) */
+template <typename T>
+static void ClaheLut (std::vector<unsigned int>& LUT, T Min, T Max, unsigned int uiNrBins)
+{
+    const unsigned int uiBinSize = 1 + (unsigned int)(Max - Min) / uiNrBins;
+    LUT.resize((size_t)std::numeric_limits<T>::max() + 1);
+    for (size_t i = 0; i < LUT.size(); i++) {
+	LUT[i] = (i <= (size_t)Min) ? 0 : ((i >= (size_t)Max ? (size_t)Max : i) - Min) / uiBinSize;
+    }
+}
+
+static void ClaheLut (std::vector<unsigned int>&, float, float, unsigned int) {}
+
+/* cumulated histogram to the mapping of the region as MapHistogram */
+template <typename T>
+static void ClaheMapT (const unsigned long* pulHistogram, T Min, T Max, unsigned int uiNrGreylevels,
+	unsigned long ulNrOfPixels, unsigned long* pulMap)
+{
+    unsigned long ulSum = 0;
+    const float fScale = ((float)(Max - Min)) / ulNrOfPixels;
+    const unsigned long ulMin = (unsigned long) Min;
+
+    for (unsigned int i = 0; i < uiNrGreylevels; i++) {
+	ulSum += pulHistogram[i]; pulMap[i]=(unsigned long)(ulMin+ulSum*fScale);
+	if (pulMap[i] > Max) pulMap[i] = Max;
+    }
+}
+
+static void ClaheMapT (const unsigned long* pulHistogram, float Min, float Max, unsigned int uiNrGreylevels,
+	unsigned long ulNrOfPixels, float* pfMap)
+{
+    unsigned long ulSum = 0;
+    const float fScale = (Max - Min) / ulNrOfPixels;
+
+    for (unsigned int i = 0; i < uiNrGreylevels; i++) {
+	ulSum += pulHistogram[i]; pfMap[i] = Min + ulSum*fScale;
+	if (pfMap[i] > Max) pfMap[i] = Max;
+    }
+}
+
+/* coordinate of the virtually padded image in the image (mirrored over the last pixel) */
+static inline unsigned int ClaheMirror (unsigned int uiPos, unsigned int uiRes)
+{
+    if (uiPos < uiRes) return uiPos;
+    return (uiPos - uiRes < uiRes) ? 2*uiRes - 1 - uiPos : 0;
+}
+
+template <typename T>
+static void ClaheRegionTaskT (int worker, int id, void* ctx)
+/* Histogram, clipping and mapping of contextual region id (as ClaheRegionTask). The part of the 
+ * region outside the image is taken from the mirrored image. */
+{
+    claheJobT<T>* pJob = (claheJobT<T>*)ctx;
+    unsigned int uiXRes = (*pJob).uiXRes, uiYRes = (*pJob).uiYRes;
+    unsigned int uiX0 = (id % (*pJob).uiNrX) * (*pJob).uiXSize, uiY0 = (id / (*pJob).uiNrX) * (*pJob).uiYSize;
+    unsigned int uiXEnd = uiX0 + (*pJob).uiXSize, uiXIn = std::max(uiX0, std::min(uiXEnd, uiXRes));
+    unsigned int uiNrBins = (*pJob).uiNrBins;
+    unsigned long* pulHist = (*pJob).pulWorkerHist + worker*(1+uiHIST_COPIES)*uiNrBins;
+    unsigned long* pulCopies = pulHist + uiNrBins;   /* counted as in MakeHistogramCopies */
+    claheJobBin<T> binOf;
+    binOf.pJob = pJob;
+
+    memset(pulCopies, 0, uiHIST_COPIES*uiNrBins*sizeof(unsigned long));
+    for (unsigned int y = uiY0; y < uiY0 + (*pJob).uiYSize; y++) {
+	const T* pImage = (*pJob).pImage + (unsigned long)ClaheMirror(y, uiYRes)*uiXRes;
+	if (uiXIn > uiX0) CountCopies(pImage + uiX0, uiXIn - uiX0, binOf, pulCopies, uiNrBins);
+	for (unsigned int x = uiXIn; x < uiXEnd; x++) pulCopies[ClaheBin(pJob, pImage[ClaheMirror(x, uiXRes)])]++;
+    }
+    SumCopies(pulCopies, uiNrBins, pulHist);
+    ClipHistogram(pulHist, uiNrBins, (*pJob).ulClipLimit);
+    ClaheMapT(pulHist, (*pJob).Min, (*pJob).Max, uiNrBins, (*pJob).ulNrPixels, &(*pJob).pMapArray[uiNrBins*id]);
+}
+
+/* bilinear interpolation of the four mappings as in Interpolate */
+template <typename T>
+static inline T ClaheBlend (typename claheMapType<T>::type ulLU, typename claheMapType<T>::type ulRU, 
+	typename claheMapType<T>::type ulLB, typename claheMapType<T>::type ulRB,
+	unsigned int uiXCoef, unsigned int uiXInvCoef, unsigned int uiYCoef, unsigned int uiYInvCoef, 
+	unsigned int uiNum, unsigned int uiShift)
+{
+    unsigned long ulVal = uiYInvCoef * (uiXInvCoef*ulLU + uiXCoef*ulRU) + uiYCoef * (uiXInvCoef*ulLB + uiXCoef*ulRB);
+    return (T)(uiShift ? ulVal >> uiShift : ulVal / uiNum);
+}
+
+template <>
+inline float ClaheBlend (float fLU, float fRU, float fLB, float fRB,
+	unsigned int uiXCoef, unsigned int uiXInvCoef, unsigned int uiYCoef, unsigned int uiYInvCoef, 
+	unsigned int uiNum, unsigned int)
+{
+    return (uiYInvCoef * (uiXInvCoef*fLU + uiXCoef*fRU) + uiYCoef * (uiXInvCoef*fLB + uiXCoef*fRB)) / uiNum;
+}
+
+/* sub-block i of the (uiNr+1) sub-blocks of a padded line: start, size and the regions (low, high) 
+ * of the mappings. The same as in Clahe for even uiSize. */
+static void ClaheSpan (unsigned int i, unsigned int uiNr, unsigned int uiSize, 
+	unsigned int* puiStart, unsigned int* puiSub, unsigned int* puiLow, unsigned int* puiHigh)
+{
+    unsigned int uiHalf = uiSize >> 1;
+    if (i == 0) {
+	*puiStart = 0; *puiSub = uiHalf; *puiLow = 0; *puiHigh = 0;
+    }
+    else if (i == uiNr) {
+	*puiStart = uiHalf + (uiNr-1)*uiSize; *puiSub = uiSize - uiHalf; *puiLow = uiNr-1; *puiHigh = uiNr-1;
+    }
+    else {
+	*puiStart = uiHalf + (i-1)*uiSize; *puiSub = uiSize; *puiLow = i-1; *puiHigh = i;
+    }
+}
+
+template <typename T>
+static void ClaheInterpolateTaskT (int id, void* ctx)
+/* Interpolation of sub-block id, only the part inside the image is written */
+{
+    typedef typename claheJobT<T>::map_t map_t;
+    claheJobT<T>* pJob = (claheJobT<T>*)ctx;
+    unsigned int uiNrX = (*pJob).uiNrX, uiNrBins = (*pJob).uiNrBins;
+    unsigned int uiX0, uiSubX, uiXL, uiXR, uiY0, uiSubY, uiYU, uiYB;
+    ClaheSpan(id % (uiNrX+1), uiNrX, (*pJob).uiXSize, &uiX0, &uiSubX, &uiXL, &uiXR);
+    ClaheSpan(id / (uiNrX+1), (*pJob).uiNrY, (*pJob).uiYSize, &uiY0, &uiSubY, &uiYU, &uiYB);
+    unsigned int uiWriteX = (uiX0 >= (*pJob).uiXRes) ? 0 : std::min(uiSubX, (*pJob).uiXRes - uiX0);
+    unsigned int uiWriteY = (uiY0 >= (*pJob).uiYRes) ? 0 : std::min(uiSubY, (*pJob).uiYRes - uiY0);
+    if ((*pJob).pBlockStats) (*pJob).pBlockStats[id].count = 0;
+    if (uiWriteX == 0 || uiWriteY == 0) return;
+
+    const map_t* pLU = &(*pJob).pMapArray[uiNrBins * (uiYU * uiNrX + uiXL)];
+    const map_t* pRU = &(*pJob).pMapArray[uiNrBins * (uiYU * uiNrX + uiXR)];
+    const map_t* pLB = &(*pJob).pMapArray[uiNrBins * (uiYB * uiNrX + uiXL)];
+    const map_t* pRB = &(*pJob).pMapArray[uiNrBins * (uiYB * uiNrX + uiXR)];
+    unsigned int uiNum = uiSubX*uiSubY, uiShift = 0;
+    if ((uiNum & (uiNum - 1)) == 0) { while (uiNum >> (uiShift+1)) uiShift++; } /* power of two, shift */
+
+    T* pImage = (*pJob).pImage + (unsigned long)uiY0*(*pJob).uiXRes + uiX0;
+    T Min = (*pJob).Max, Max = (*pJob).Min;
+    double dSum = 0;
+    for (unsigned int uiYCoef = 0, uiYInvCoef = uiSubY; uiYCoef < uiWriteY; 
+	 uiYCoef++, uiYInvCoef--, pImage += (*pJob).uiXRes) {
+	for (unsigned int uiXCoef = 0, uiXInvCoef = uiSubX; uiXCoef < uiWriteX; uiXCoef++, uiXInvCoef--) {
+	    unsigned int uiBin = ClaheBin(pJob, pImage[uiXCoef]);
+	    T value = ClaheBlend<T>(pLU[uiBin], pRU[uiBin], pLB[uiBin], pRB[uiBin], 
+				    uiXCoef, uiXInvCoef, uiYCoef, uiYInvCoef, uiNum, uiShift);
+	    pImage[uiXCoef] = value;
+	    Min = (value < Min) ? value : Min;
+	    Max = (value > Max) ? value : Max;
+	    dSum += value;
+	}
+    }
+    if ((*pJob).pBlockStats) {
+	imageStats_t* pStats = &(*pJob).pBlockStats[id];
+	(*pStats).minVal = Min; (*pStats).maxVal = Max;
+	(*pStats).sum = dSum; (*pStats).count = uiWriteX*uiWriteY;
+	(*pStats).valid = true;
+    }
+}
+
+void claheWorkRelease (claheWork_t* pWork)
+{
+    std::vector<unsigned long>().swap((*pWork).ulMaps);
+    std::vector<float>().swap((*pWork).fMaps);
+    std::vector<unsigned long>().swap((*pWork).ulWorkerHist);
+    std::vector<imageStats_t>().swap((*pWork).blockStats);
+    std::vector<unsigned int>().swap((*pWork).LUT);
+}
+
+template <typename T>
+int ClaheT (T* pImage, unsigned int uiXRes, unsigned int uiYRes, T Min, T Max,
+	unsigned int uiNrX, unsigned int uiNrY, unsigned int uiNrBins, float fCliplimit, imageStats_t* pStats,
+	claheWork_t* pWork)
+{
+    claheJobT<T> job;
+    claheWork_t localWork;		  /* freed on return if no work area given */
+    unsigned int uiBlocks = (uiNrX+1)*(uiNrY+1);
+
+    if (uiNrX > uiXRes) return -3;	  /* regions smaller than a pixel in x-direction */
+    if (uiNrY > uiYRes) return -4;	  /* regions smaller than a pixel in y-direction */
+    if (!(Min < Max)) return -6;	  /* minimum equal or larger than maximum */
+    if (uiNrX < 2 || uiNrY < 2) return -7;/* at least 4 contextual regions required */
+    if (pStats) (*pStats).valid = false;
+    if (fCliplimit == 1.0) return 0;	  /* is OK, immediately returns original image. */
+    if (uiNrBins == 0) uiNrBins = 128;	  /* default value when not specified */
+    if (pWork == 0) pWork = &localWork;
+
+    int iWorkers = getThreadCount();
+    size_t workerHist = (size_t)iWorkers*(1+uiHIST_COPIES)*uiNrBins; /* histogram and its copies */
+    if ((*pWork).ulWorkerHist.size() < workerHist) (*pWork).ulWorkerHist.resize(workerHist);
+    if ((*pWork).blockStats.size() < uiBlocks) (*pWork).blockStats.resize(uiBlocks);
+    job.pMapArray = ClaheMapBuffer(pWork, (size_t)uiNrX*uiNrY*uiNrBins, (typename claheJobT<T>::map_t*)0);
+    job.pulWorkerHist = &(*pWork).ulWorkerHist[0];
+    job.pBlockStats = pStats ? &(*pWork).blockStats[0] : 0;
+
+    job.pImage = pImage;
+    job.uiXRes = uiXRes; job.uiYRes = uiYRes;
+    job.uiNrX = uiNrX; job.uiNrY = uiNrY;
+    job.uiXSize = (uiXRes + uiNrX - 1)/uiNrX; job.uiYSize = (uiYRes + uiNrY - 1)/uiNrY;
+    job.uiNrBins = uiNrBins;
+    job.Min = Min; job.Max = Max;
+    job.ulNrPixels = (unsigned long)job.uiXSize * (unsigned long)job.uiYSize;
+    if(fCliplimit > 0.0) {		  /* Calculate actual cliplimit	 */
+       job.ulClipLimit = (unsigned long) (fCliplimit * (job.uiXSize * job.uiYSize) / uiNrBins);
+       job.ulClipLimit = (job.ulClipLimit < 1UL) ? 1UL : job.ulClipLimit;
+    }
+    else job.ulClipLimit = 1UL<<14;	  /* Large value, do not clip (AHE) */
+
+    ClaheLut((*pWork).LUT, Min, Max, uiNrBins);
+    job.puiLUT = (*pWork).LUT.empty() ? 0 : &(*pWork).LUT[0];
+    job.fBinScale = uiNrBins / (float)(Max - Min);
+
+    parallelWorkers(uiNrX*uiNrY, ClaheRegionTaskT<T>, &job);
+    parallelFor(uiBlocks, ClaheInterpolateTaskT<T>, &job);
+
+    if (pStats) {			  /* merged in sub-block order (independent of threads) */
+	imageStats_t all;
+	all.minVal = Max; all.maxVal = Min;
+	all.valid = true;
+	for (unsigned int i = 0; i < uiBlocks; i++) {
+	    const imageStats_t& block = job.pBlockStats[i];
+	    if (block.count == 0) continue;
+	    all.minVal = (block.minVal < all.minVal) ? block.minVal : all.minVal;
+	    all.maxVal = (block.maxVal > all.maxVal) ? block.maxVal : all.maxVal;
+	    all.sum   += block.sum;
+	    all.count += block.count;
+	}
+	*pStats = all;
+    }
+    return 0;
+}
+
+template int ClaheT<unsigned char>(unsigned char*, unsigned int, unsigned int, unsigned char, unsigned char,
+	unsigned int, unsigned int, unsigned int, float, imageStats_t*, claheWork_t*);
+template int ClaheT<unsigned short>(unsigned short*, unsigned int, unsigned int, unsigned short, unsigned short,
+	unsigned int, unsigned int, unsigned int, float, imageStats_t*, claheWork_t*);
+template int ClaheT<float>(float*, unsigned int, unsigned int, float, float,
+	unsigned int, unsigned int, unsigned int, float, imageStats_t*, claheWork_t*);
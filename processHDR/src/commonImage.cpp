@@ -67,8 +67,8 @@ int saveTIFF( const char *path, commonImage_t *image, compressionType_e cType, b
      default:
        if (verbose)
 	 std::cerr << "Unsupported image format encountered" << std::endl;
-       rval = -2;
-       break;
+       TIFFClose(out);
+       return -2;
      }
      TIFFSetField( out, TIFFTAG_BITSPERSAMPLE, bitspersample);   
 
@@ -138,9 +138,10 @@ int readTIFF (const char *path, commonImage_t *image, bool verbose )
 
   if (tif) {
     tsize_t scanline;
-    char *buf;
     int32 row;
     uint16 spp, bps, photo;
+    commonImage_t previous = *image; //buffer reused if same size and type
+    bool knownType = true;
 
     TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &image->height );
     TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &image->width );
@@ -168,13 +169,18 @@ int readTIFF (const char *path, commonImage_t *image, bool verbose )
     else{
       if (verbose)
 	std::cerr << "commonImage::readTIFF unsupported image type encountered" << std::endl;
+      knownType = false;
     }    
 
     scanline = TIFFScanlineSize(tif);
-    buf =(char*) _TIFFmalloc(scanline*sizeof(char) );
-    image->data = (char*) _TIFFmalloc(scanline*sizeof(char)*image->height );
+    if (previous.data == NULL || !knownType || previous.mode != image->mode || 
+	previous.width != image->width || previous.height != image->height){
+      if (previous.data != NULL)
+	_TIFFfree(previous.data);
+      image->data = (char*) _TIFFmalloc(scanline*sizeof(char)*image->height );
+    }
 
-    if (!buf || !image->data){
+    if (!image->data){
       if (verbose)
 	std::cerr << "commonImage::readTIFF could not allocate memory" << std::endl;
       rval = -2;
@@ -183,13 +189,11 @@ int readTIFF (const char *path, commonImage_t *image, bool verbose )
       char *ptOut = (char*)(image->data);
       for (row = 0; row < image->height ; row++)
 	{
-	  TIFFReadScanline(tif, buf, row);
-	  memcpy( ptOut, buf, scanline );
+	  TIFFReadScanline(tif, ptOut, row);
 	  ptOut += scanline;
 	}
-      _TIFFfree(buf);
-      TIFFClose(tif);
     }
+    TIFFClose(tif);
   }
   else {
     if (verbose)
@@ -170,4 +170,23 @@ namespace FileIO
  }
 
 
+ /******************************************************************************
+  * List sub folders
+  */
+  void getDirNames(std::vector<std::string>  &dirs, std::string path)
+ {
+	std::vector<std::string> names;
+	getFileNames( names, path );
+	
+	if (path.length() > 0 && path[path.length()-1] != '/'){ path += "/"; }
+	
+	for (unsigned int i=0; i < names.size(); i++){
+		std::string fullPath = path + names[i];
+		if ( dirExist( (char*)fullPath.c_str() ) ){
+			dirs.push_back( names[i] );
+		}
+	}
+ }
+
+
 }
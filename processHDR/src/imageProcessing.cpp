@@ -10,8 +10,15 @@
 #include <stdint.h>
 #include <string.h>
 #include <limits>
+#include <algorithm>
 #include <cmath>
 #include "imageProcessing.h"
+#include "parallel.h"
+#include "simdKernels.h"
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
  
 #ifdef _WIN32
 	int isnan(double x) { return x != x; }
@@ -20,11 +27,566 @@
 
  #include <iostream> //DEBUG only
  
+/*****************************************************************************
+ * Pixel kernels. The loops are templates instantiated once per pixel type 
+ * (and output type) and the image mode is dispatched to the type once per 
+ * call (dispatchGray) so each instantiation is a plain loop the compiler 
+ * can vectorize.
+ */
+  
+  //the type pixel values are compared in when scanning min and max (as the original loops did)
+  template <typename InT> struct scanType               { typedef InT type; };
+  template <>             struct scanType<unsigned int> { typedef int type; };
+  
+  template <typename T> static T lowestValue() { return std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max(); }
+  
+  /**
+   * Call op.run() with data of gray image as its pixel type 
+   * @return op.run() return value or -2 for RGB images
+   */
+  template <class Op>
+  static int dispatchGray( commonImage_t *image, Op &op )
+  {
+	void *data = (*image).data;
+	
+	switch((*image).mode){
+		case Gray8bpp:
+			return op.run( (unsigned char*)data );
+		case Gray10bpp:
+		case Gray12bpp:
+		case Gray14bpp:
+		case Gray16bpp:
+			return op.run( (unsigned short*)data );
+		case Gray24bpp:
+		case Gray32bpp:
+			return op.run( (unsigned int*)data );
+		case Double1D:
+			return op.run( (double*)data );
+		case Float1D:
+			return op.run( (float*)data );
+		case RGB8bpp:
+		case RGBA8bpp:
+			break;
+	}
+	return -2;
+  }
+  
+  /**
+   * out[i] += in[i]
+   */
+  template <typename InT>
+  static void addKernel( const InT *in, unsigned int *out, int count )
+  {
+	for (int i = 0; i < count; i++){
+		out[i] += (unsigned int)in[i];
+	}
+  }
+  
+  /**
+   * out[i] += in[i]*weight 
+   */
+  template <typename InT>
+  static void addWeightedKernel( const InT *in, float weight, float *out, int count )
+  {
+	for (int i = 0; i < count; i++){
+		out[i] += (float)in[i] * weight;
+	}
+  }
+  
+  template <>
+  void addWeightedKernel<unsigned short>( const unsigned short *in, float weight, float *out, int count )
+  {
+	addWeightedU16( in, weight, out, count ); //explicitly vectorized (simdKernels.h)
+  }
+  
+  /**
+   * out[i] += in[i]*weight in 64 bit integers (integer pixel types only)
+   */
+  template <typename InT>
+  static void addScaledKernel( const InT *in, uint64_t weight, uint64_t *out, int count )
+  {
+	for (int i = 0; i < count; i++){
+		out[i] += (uint64_t)in[i] * weight;
+	}
+  }
+  
+  template <>
+  void addScaledKernel<unsigned short>( const unsigned short *in, uint64_t weight, uint64_t *out, int count )
+  {
+	addScaledU16( in, (uint32_t)weight, out, count ); //explicitly vectorized (simdKernels.h)
+  }
+  
+  /**
+   * Pixels [first, end) of band id when count pixels are split in bands
+   */
+  static void bandBounds( int count, int bands, int id, int &first, int &end )
+  {
+	first = (int)((int64_t)count*id/bands);
+	end   = (int)((int64_t)count*(id+1)/bands);
+  }
+  
+  /**
+   * Number of bands for a pixel loop (one per thread, small data in one band)
+   */
+  static int pixelBands( int count )
+  {
+	int bands = getThreadCount();
+	return (count < bands*16384) ? 1 : bands;
+  }
+  
+  /**
+   * Native min and max of data, mn and mx are given the initial values
+   */
+  template <typename InT, typename ScanT>
+  static void nativeMinMax( const InT *in, int count, ScanT &mn, ScanT &mx )
+  {
+	for (int i = 0; i < count; i++){
+		ScanT val = in[i];
+		mn = (val < mn) ? val : mn;
+		mx = (val > mx) ? val : mx;
+	}
+  }
+  
+  static void nativeMinMax( const float *in, int count, float &mn, float &mx )
+  {
+	minMaxF32( in, count, &mn, &mx ); //explicitly vectorized (simdKernels.h)
+  }
+  
+  template <typename InT>
+  struct minMaxBands{
+	typedef typename scanType<InT>::type ScanT;
+	const InT *in; int count; int bands;
+	std::vector<ScanT> mins; //min of each band
+	std::vector<ScanT> maxs; //max of each band (first pixel not counted)
+  };
+  
+  template <typename InT>
+  static void minMaxBandTask( int id, void *ctx )
+  {
+	typedef typename scanType<InT>::type ScanT;
+	minMaxBands<InT> &b = *(minMaxBands<InT>*)ctx;
+	int first, end;
+	bandBounds( b.count, b.bands, id, first, end );
+	
+	ScanT mn = std::numeric_limits<ScanT>::max();
+	ScanT mx = lowestValue<ScanT>();
+	if (first == 0){ //first pixel counts for min only
+		nativeMinMax( b.in+1, end-1, mn, mx );
+		ScanT val = b.in[0];
+		mn = (val < mn) ? val : mn;
+	} else {
+		nativeMinMax( b.in+first, end-first, mn, mx );
+	}
+	b.mins[id] = mn;
+	b.maxs[id] = mx;
+  }
+  
+  /**
+   * Min and max as the original scan loops gave them:
+   *   if (val < minVal) minVal = val; else if (val > maxVal) maxVal = val;
+   * ie the first pixel (and any pixel lowering the min) is not counted for max.
+   * Computed here with min and max reductions over bands of pixels in parallel,
+   * the sequential scan is used only when the first pixel(s) could have 
+   * affected the max. minVal and maxVal are given the initial values.
+   * 
+   * With valid stats (min and max of all pixels) the reductions are skipped 
+   * if the first pixel is below the max (then the max of the rest is known). 
+   * On return stats min and max are those of all pixels (sum is not touched). 
+   */
+  template <typename InT, typename LimT>
+  static void minMaxKernel( const InT *in, int count, LimT &minVal, LimT &maxVal, imageStats_t &stats )
+  {
+	typedef typename scanType<InT>::type ScanT;
+	if (count <= 0) { return; }
+	
+	ScanT first = in[0];
+	ScanT nativeMin, nativeMax; //min of all pixels, max of pixels after the first
+	
+	if (stats.valid && stats.count == count && stats.maxVal > first &&
+		stats.minVal >= lowestValue<ScanT>() && stats.maxVal <= std::numeric_limits<ScanT>::max()){
+		nativeMin = (ScanT)stats.minVal;
+		nativeMax = (ScanT)stats.maxVal;
+	}
+	else{
+		minMaxBands<InT> b;
+		b.in = in; b.count = count; b.bands = pixelBands( count );
+		b.mins.resize( b.bands );
+		b.maxs.resize( b.bands );
+		parallelFor( b.bands, minMaxBandTask<InT>, &b );
+		
+		nativeMin = b.mins[0];
+		nativeMax = b.maxs[0];
+		for (int id = 1; id < b.bands; id++){
+			nativeMin = (b.mins[id] < nativeMin) ? b.mins[id] : nativeMin;
+			nativeMax = (b.maxs[id] > nativeMax) ? b.maxs[id] : nativeMax;
+		}
+		stats.minVal = nativeMin;
+		stats.maxVal = (first > nativeMax) ? first : nativeMax;
+	}
+	
+	LimT minFirst = (first < minVal) ? (LimT)first : minVal;  //min after the first pixel
+	LimT maxRest  = (nativeMax > maxVal) ? (LimT)nativeMax : maxVal;
+	
+	if (first < minVal && (maxRest == maxVal || maxRest > minFirst)){ //max pixel was counted
+		if (nativeMin < minVal) { minVal = (LimT)nativeMin; }
+		maxVal = maxRest;
+		return;
+	}
+	
+	for (int i = 0; i < count; i++){
+		ScanT val = in[i];
+		if (val < minVal)		{ minVal = (LimT)val; }
+		else if(val > maxVal) 	{ maxVal = (LimT)val; }
+	}
+  }
+  
+  /**
+   * out[i] = (in[i]-minVal)*range computed in CalcT
+   */
+  template <typename InT, typename OutT, typename CalcT>
+  static void normaliseKernel( const InT *in, OutT *out, int count, CalcT minVal, CalcT range )
+  {
+	for (int i = 0; i < count; i++){
+		out[i] = (OutT)(((CalcT)in[i]-minVal)*range);
+	}
+  }
+  
+  /**
+   * Sum of pixels, integer data summed exactly in 64 bits (as the double sum 
+   * of the original loop), floating point data with four partial sums 
+   */
+  template <typename InT>
+  static double sumKernel( const InT *in, int count )
+  {
+	if (std::numeric_limits<InT>::is_integer){
+		uint64_t sum = 0;
+		for (int i = 0; i < count; i++){
+			sum += in[i];
+		}
+		return (double)sum;
+	}
+	
+	double sum[4] = {0, 0, 0, 0};
+	int i = 0;
+	for (; i+3 < count; i += 4){
+		sum[0] += in[i];
+		sum[1] += in[i+1];
+		sum[2] += in[i+2];
+		sum[3] += in[i+3];
+	}
+	for (; i < count; i++){
+		sum[0] += in[i];
+	}
+	return (sum[0]+sum[1])+(sum[2]+sum[3]);
+  }
+  
+  /**
+   * Stats of data
+   */
+  template <typename T>
+  static void dataStats( const T *in, int count, imageStats_t *stats )
+  {
+	T mn = std::numeric_limits<T>::max();
+	T mx = lowestValue<T>();
+	nativeMinMax( in, count, mn, mx );
+	(*stats).minVal = mn;
+	(*stats).maxVal = mx;
+	(*stats).sum    = sumKernel( in, count );
+	(*stats).count  = count;
+	(*stats).valid  = true;
+  }
+  
+  /**
+   * Stats of image from stats of its parts (merged in the given order so the 
+   * result do not depend on the number of threads)
+   */
+  static void mergeStats( const std::vector<imageStats_t> &parts, imageStats_t *stats )
+  {
+	imageStats_t all;
+	all.minVal = std::numeric_limits<double>::max();
+	all.maxVal = -std::numeric_limits<double>::max();
+	all.valid = true;
+	
+	for (size_t i = 0; i < parts.size(); i++){
+		if (!parts[i].valid) { all.valid = false; }
+		if (parts[i].count == 0) { continue; }
+		all.minVal = (parts[i].minVal < all.minVal) ? parts[i].minVal : all.minVal;
+		all.maxVal = (parts[i].maxVal > all.maxVal) ? parts[i].maxVal : all.maxVal;
+		all.sum   += parts[i].sum;
+		all.count += parts[i].count;
+	}
+	*stats = all;
+  }
+  
+  /**
+   * out[i] = lut[in[i]] (integer data only)
+   */
+  template <typename InT, typename OutT>
+  static void lutKernel( const InT *in, OutT *out, int count, const OutT *lut )
+  {
+	for (int i = 0; i < count; i++){
+		out[i] = lut[(int)in[i]];
+	}
+  }
+  
+  //number of lookup table entries for all values of pixel type (0 if no table is used)
+  template <typename InT> struct lutEntries                 { enum { value = 0 }; };
+  template <>             struct lutEntries<unsigned char>  { enum { value = 256 }; };
+  template <>             struct lutEntries<unsigned short> { enum { value = 65536 }; };
+  
+  template <typename InT, typename OutT, typename CalcT>
+  struct normaliseRows{
+	const InT *in; OutT *out; int width;
+	CalcT minVal; CalcT range;
+	const OutT *lut;        //rescaled values of all pixel values or NULL
+	imageStats_t *rowStats; //sums of output rows (or NULL)
+  };
+  
+  template <typename InT, typename OutT, typename CalcT>
+  static void normaliseRowTask( int rowStart, int rowEnd, void *ctx )
+  {
+	normaliseRows<InT,OutT,CalcT> &r = *(normaliseRows<InT,OutT,CalcT>*)ctx;
+	for (int y = rowStart; y < rowEnd; y++){
+		OutT *out = r.out + y*r.width;
+		if (r.lut != NULL){
+			lutKernel( r.in + y*r.width, out, r.width, r.lut );
+		}
+		else{
+			normaliseKernel( r.in + y*r.width, out, r.width, r.minVal, r.range );
+		}
+		if (r.rowStats != NULL){ //the row is still in cache
+			r.rowStats[y].sum = sumKernel( out, r.width );
+			r.rowStats[y].count = r.width;
+			r.rowStats[y].valid = true;
+		}
+	}
+  }
+  
+  /*
+   * Ops for dispatchGray
+   */
+  typedef struct _addOp{
+	unsigned int *out; int first; int count;
+	template <typename InT> int run( const InT *in ) { addKernel( in+first, out, count ); return 0; }
+  }addOp_t;
+  
+  typedef struct _addWeightedOp{
+	float weight; float *out; int first; int count;
+	template <typename InT> int run( const InT *in ) { addWeightedKernel( in+first, weight, out, count ); return 0; }
+  }addWeightedOp_t;
+  
+  typedef struct _addScaledOp{
+	uint64_t weight; uint64_t *out; int first; int count;
+	template <typename InT> int run( const InT *in ) 
+	{ 
+		if (!std::numeric_limits<InT>::is_integer) { return -2; }
+		addScaledKernel( in+first, weight, out, count ); 
+		return 0; 
+	}
+  }addScaledOp_t;
+  
+  typedef struct _sumOp{
+	int count; double sum;
+	template <typename InT> int run( const InT *in ) { sum = sumKernel( in, count ); return 0; }
+  }sumOp_t;
+  
+  /**
+   * Scale data to [0 scale] in OutT: min and max found in LimT, 
+   * the rescale computed in CalcT (in parallel row bands). For 8-16 bit
+   * data to integer output computed in double the rescale is done once per 
+   * value in [min max] to a lookup table (the same result with one load per 
+   * pixel, in float the vectorized arithmetic is faster than the loads).
+   * The min and max are taken from inStats if valid, outStats is filled
+   * if given: min and max of output are those of input mapped (the mapping 
+   * is monotonic) and the sum is computed of each row as it is written.
+   */
+  template <typename OutT, typename LimT, typename CalcT>
+  struct normaliseOp{
+	normaliseOp( OutT *_out, int _width, int _height, double _scale, LimT _maxInit, const imageStats_t *_inStats, imageStats_t *_outStats ): 
+		out(_out), width(_width), height(_height), scale(_scale), maxInit(_maxInit), inStats(_inStats), outStats(_outStats){};
+	
+	OutT *out; 
+	int width; 
+	int height;
+	double scale;  //output range
+	LimT maxInit;  //initial max value
+	const imageStats_t *inStats;
+	imageStats_t *outStats;
+	
+	template <typename InT> int run( const InT *in )
+	{
+		typedef typename scanType<InT>::type ScanT;
+		int count = width*height;
+		imageStats_t stats;
+		if (inStats != NULL) { stats = *inStats; }
+		
+		LimT minVal = std::numeric_limits<LimT>::max();
+		LimT maxVal = maxInit;
+		minMaxKernel( in, count, minVal, maxVal, stats );
+		
+		normaliseRows<InT,OutT,CalcT> r;
+		r.in = in; r.out = out; r.width = width;
+		r.minVal = (CalcT)minVal;
+		r.range  = (CalcT)(scale/(maxVal-minVal));
+		r.lut = NULL;
+		
+		std::vector<OutT> lut;
+		if (lutEntries<InT>::value > 0 && std::numeric_limits<OutT>::is_integer && sizeof(CalcT) > sizeof(float) &&
+			stats.maxVal-stats.minVal < count){ //stats has min and max of all pixels
+			lut.resize( lutEntries<InT>::value );
+			for (int val = (int)stats.minVal; val <= (int)stats.maxVal; val++){
+				lut[val] = (OutT)(((CalcT)(InT)val - r.minVal)*r.range);
+			}
+			r.lut = &lut[0];
+		}
+		
+		std::vector<imageStats_t> rowStats;
+		r.rowStats = NULL;
+		if (outStats != NULL && count > 0){
+			rowStats.resize( height );
+			r.rowStats = &rowStats[0];
+		}
+		parallelRows( height, normaliseRowTask<InT,OutT,CalcT>, &r );
+		
+		if (outStats != NULL){
+			mergeStats( rowStats, outStats );
+			
+			//all pixels within [minVal maxVal] so that output is not wrapped
+			bool inRange = count > 0 && r.range > 0 && r.range <= std::numeric_limits<CalcT>::max() &&
+						   (double)minVal <= stats.minVal && stats.maxVal <= (double)maxVal;
+			(*outStats).valid  = (*outStats).valid && inRange;
+			(*outStats).minVal = (OutT)(((CalcT)(InT)(ScanT)stats.minVal - r.minVal)*r.range);
+			(*outStats).maxVal = (OutT)(((CalcT)(InT)(ScanT)stats.maxVal - r.minVal)*r.range);
+		}
+		return 0;
+	}
+  };
+
+/***************************************************
+ * Add pixels [first, first+count) of single gray image to sum buffer
+ */
+  static int addPixels( commonImage_t *image, unsigned int *pOut, int first, int count )
+  {
+	addOp_t op;
+	op.out = pOut; op.first = first; op.count = count;
+	return dispatchGray( image, op );
+  }
+  
+  /*****************************************************************************
+   * Add pixels [first, first+count) of single image weighted with exposure time 
+   * to float sum buffer
+   */
+  static int addWeightedPixels( commonImage_t *image, float weight, float *pOut, int first, int count )
+  {
+	addWeightedOp_t op;
+	op.weight = weight; op.out = pOut; op.first = first; op.count = count;
+	return dispatchGray( image, op );
+  }
+  
+  /*****************************************************************************
+   * Add pixels [first, first+count) of single integer image weighted with integer
+   * exposure time to 64 bit sum buffer
+   */
+  static int addScaledPixels( commonImage_t *image, uint64_t weight, uint64_t *pOut, int first, int count )
+  {
+	addScaledOp_t op;
+	op.weight = weight; op.out = pOut; op.first = first; op.count = count;
+	return dispatchGray( image, op );
+  }
+  
+  /*****************************************************************************
+   * Stack sums split to row bands (see parallel.h). Each band adds all images
+   * in stack order so the result do not depend on the number of bands.
+   */
+  typedef struct _stackSum{
+	commonImage_t *images;  //images to be summed (nImages)
+	float *weights;         //exposure times (NULL for plain sum)
+	const uint64_t *intWeights; //integer exposure times (for exact sum, weights NULL)
+	int nImages;
+	int width;
+	void *out;              //unsigned int (plain sum), float (weighted) or uint64_t (exact)
+	int tilePixels;         //tile size for sumStackTile
+	imageStats_t *tileStats; //stats of each (float) tile or NULL
+  }stackSum_t;
+  
+  static void sumStackPixels( stackSum_t *s, int first, int count )
+  {
+	for (int id = 0; id < (*s).nImages; id++){
+		if ((*s).intWeights != NULL){
+			addScaledPixels( &(*s).images[id], (*s).intWeights[id], (uint64_t*)(*s).out + first, first, count );
+		}
+		else if ((*s).weights == NULL){
+			addPixels( &(*s).images[id], (unsigned int*)(*s).out + first, first, count );
+		}
+		else{
+			addWeightedPixels( &(*s).images[id], (*s).weights[id], (float*)(*s).out + first, first, count );
+		}
+	}
+  }
+  
+  static void sumStackRows( int rowStart, int rowEnd, void *ctx )
+  {
+	stackSum_t *s = (stackSum_t*)ctx;
+	sumStackPixels( s, rowStart*(*s).width, (rowEnd-rowStart)*(*s).width );
+  }
+  
+  static void sumStackTile( int id, void *ctx )
+  {
+	stackSum_t *s = (stackSum_t*)ctx;
+	int pixels = (*s).width*(*s).images[0].height;
+	int first = id*(*s).tilePixels;
+	int count = (first+(*s).tilePixels < pixels) ? (*s).tilePixels : pixels-first;
+	sumStackPixels( s, first, count );
+	if ((*s).tileStats != NULL){ //the tile is still in cache
+		dataStats( (float*)(*s).out + first, count, &(*s).tileStats[id] );
+	}
+  }
+  
+  //tilePixels 0 for row bands, intWeights for exact integer sum (only integer images)
+  //stats of weighted sum can be computed with tiles
+  static int sumStack( commonImage_t *images, float *weights, int nImages, void *out, int tilePixels=0, const uint64_t *intWeights=NULL, 
+                       imageStats_t *stats=NULL )
+  {
+	for (int id = 0; id < nImages; id++){
+		if (images[id].mode == RGB8bpp || images[id].mode == RGBA8bpp) { return -2; }
+		if (intWeights != NULL && (images[id].mode == Double1D || images[id].mode == Float1D)) { return -2; }
+	}
+	
+	stackSum_t s;
+	s.images  = images;
+	s.weights = weights;
+	s.intWeights = intWeights;
+	s.nImages = nImages;
+	s.width   = (*images).width;
+	s.out     = out;
+	s.tilePixels = tilePixels;
+	s.tileStats  = NULL;
+	
+	if (tilePixels > 0){
+		int pixels = (*images).width*(*images).height;
+		int tiles  = (pixels+tilePixels-1)/tilePixels;
+		std::vector<imageStats_t> tileStats;
+		if (stats != NULL && weights != NULL && tiles > 0){
+			tileStats.resize( tiles );
+			s.tileStats = &tileStats[0];
+		}
+		parallelFor( tiles, sumStackTile, &s );
+		if (stats != NULL) { mergeStats( tileStats, stats ); }
+	}
+	else{
+		parallelRows( (*images).height, sumStackRows, &s );
+	}
+	
+	return 0;
+  }
+  
 /***************************************************
  * Create simple sum image from stack of gray images
  */
   int sumGrayStack( std::vector<commonImage_t> &stack, commonImage_t *output)
   {    
+	if (stack.size() == 0 || output == NULL) { return -2;} 
+	
 	std::vector<commonImage_t>::iterator image = stack.begin();  
 	int width  = (*image).width;
 	int height = (*image).height;
@@ -41,87 +603,7 @@
 		}		
 	}
 	
-	unsigned int *pOut;
-	
-	switch((*image).mode){
-	
-		case Gray8bpp:{
-			unsigned char *pIn;			
-			while ( image != stack.end() ){  
-				pIn = (unsigned char*)(*image++).data;
-				pOut = (unsigned int*)(*output).data;
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += *pIn++;
-				}
-			}
-			break;
-		}
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn;			
-			while ( image != stack.end() ){  
-				pIn = (unsigned short*)(*image++).data;
-				pOut = (unsigned int*)(*output).data;
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (unsigned int)(*pIn++);
-				}
-			}
-			break;
-		}
-		
-			break;
-		case Gray24bpp:
-		case Gray32bpp:
-		{
-			unsigned int *pIn;			
-			while ( image != stack.end() ){  
-				pIn = (unsigned int*)(*image++).data;
-				pOut = (unsigned int*)(*output).data;
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += *pIn++;
-				}
-			}
-			break;
-		}			
-		case Double1D:
-		{
-			double *pIn;			
-			while ( image != stack.end() ){  
-				pIn = (double*)(*image++).data;
-				pOut = (unsigned int*)(*output).data;
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (unsigned int)*pIn++;
-				}
-			}
-			break;
-		}
-		
-		case Float1D:
-		{
-			float *pIn;			
-			while ( image != stack.end() ){  
-				pIn = (float*)(*image++).data;
-				pOut = (unsigned int*)(*output).data;
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (unsigned int)*pIn++;
-				}
-			}
-			break;
-		}
-		
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-    } 
-	
-	return 0;
+	return sumStack( &stack[0], NULL, stack.size(), (*output).data );
   }
   
 
@@ -138,7 +620,7 @@
 	int height = (*image).height;
 	int pixels = width*height;
 		
-	if (maxId<0) { maxId = stack.size(); }
+	if (maxId<0 || maxId >= (int)stack.size()) { maxId = stack.size()-1; }
 	
 	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
 		(*output).mode = Float1D;
@@ -151,401 +633,229 @@
 		}		
 	}	
 	
-	float *pOut;
-	int id = 0;
-	float weight;
-	switch((*image).mode){
-	
-		case Gray8bpp:{
-			unsigned char *pIn;			
-			while ( image != stack.end() && id <= maxId ){  
-				pIn = (unsigned char*)(*image++).data;
-				pOut = (float*)(*output).data;
-				weight = expTimes[id++];
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (*pIn++) * weight;
-				}
-			}
-			break;
-		}
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn;			
-			while ( image != stack.end() && id <= maxId ){  
-				pIn = (unsigned short*)(*image++).data;
-				pOut = (float*)(*output).data;
-				weight = expTimes[id++];
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (*pIn++) * weight;
-				}
-			}
-			break;
-		}
-		
-			break;
-		case Gray24bpp:
-		case Gray32bpp:
-		{
-			unsigned int *pIn;			
-			while ( image != stack.end() && id <= maxId ){  
-				pIn = (unsigned int*)(*image++).data;
-				pOut = (float*)(*output).data;
-				weight = expTimes[id++];
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (*pIn++) * weight;
-				}
-			}
-			break;
-		}
-		
-			break;
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:
-		{
-			double *pIn;			
-			while ( image != stack.end() && id <= maxId ){  
-				pIn = (double*)(*image++).data;
-				pOut = (float*)(*output).data;
-				weight = expTimes[id++];
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (float)(*pIn++) * weight;
-				}
-			}
-			break;
-		}
-		
-		case Float1D:
-		{
-			float *pIn;			
-			while ( image != stack.end() && id <= maxId ){  
-				pIn = (float*)(*image++).data;
-				pOut = (float*)(*output).data;
-				weight = expTimes[id++];
-				int count = pixels;
-				while(count-- > 0){
-					*pOut++ += (*pIn++) * weight;
-				}
-			}
-			break;
-		}
-		
-    } 
-	
-	return 0;
+	return sumStack( &stack[0], expTimes, maxId+1, (*output).data );
   }
   
-  
-/************************************************************
- * Scale image data to range 0-255 
- */
- int normaliseGrayTo8bit( commonImage_t *input, commonImage_t *output )
- {
-	int width  = (*input).width;
-	int height = (*input).height;
-	int pixels = width*height;
+  /*****************************************************************************
+   * Exposure time weighted stack sum tile by tile (all images added to a tile 
+   * before next one so that the sum stays in cache)
+   */
+  int sumGrayStackWExpTimesTiled( std::vector<commonImage_t> &stack, float *expTimes, commonImage_t *output, int maxId, int tilePixels,
+                                  imageStats_t *stats )
+  { 
+	if (stack.size() == 0 || expTimes == NULL || output == NULL || tilePixels <= 0) { return -2;} 
 	
-	double maxVal = std::numeric_limits<double>::min();
-	double minVal = std::numeric_limits<double>::max();
-	double range;
+	int width  = stack[0].width;
+	int height = stack[0].height;
+	int pixels = width*height;
 		
-	if ((*output).data == NULL || (*output).mode != Gray8bpp || (*output).width*(*output).height < pixels ){
-		(*output).mode = Gray8bpp;
+	if (maxId<0 || maxId >= (int)stack.size()) { maxId = stack.size()-1; }
+	
+	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
+		(*output).mode = Float1D;
 		(*output).width = width;
 		(*output).height = height;		
-		(*output).data = realloc( (*output).data, pixels*sizeof(char) );
-		if ((*output).data == NULL){
+		if ((*output).data != NULL){ free((*output).data); }
+		(*output).data = calloc( pixels, sizeof(float));
+		if ((*output).data == NULL){
 			return -1;
 		}		
-	}
+	}	
 	
-	unsigned char *pOut = (unsigned char*)(*output).data;	
+	return sumStack( &stack[0], expTimes, maxId+1, (*output).data, tilePixels, NULL, stats );
+  }
+  
+  /*****************************************************************************
+   * Streaming stack sum (one image at a time)
+   */
+  int hdrAccumulatorOpen( hdrAccumulator_t *acc, int width, int height, bool exact )
+  {
+	if (acc == NULL || width <= 0 || height <= 0) { return -2; }
 	
-	switch((*input).mode){
+	commonImage_t *sum = &(*acc).sum;
+	int pixels = width*height;
 	
-		case Gray8bpp:{
-			unsigned char *pIn;			
-			pIn = (unsigned char*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned char val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 255/(maxVal-minVal);			
-			pIn = (unsigned char*)(*input).data;			
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char)(((double)(*pIn++)-minVal)*range);
-			}
-			break;
+	if ((*sum).data == NULL || (*sum).mode != Float1D || (*sum).width*(*sum).height < pixels ){
+		if ((*sum).data != NULL){ free((*sum).data); }
+		(*sum).data = calloc( pixels, sizeof(float));
+		if ((*sum).data == NULL){
+			return -1;
 		}
-		
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn;			
-			pIn = (unsigned short*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned short val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 255/(maxVal-minVal);
-			
-			pIn = (unsigned short*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char)(((double)(*pIn++)-minVal)*range);
+	}
+	else if (!exact){
+		memset( (*sum).data, 0, pixels*sizeof(float) );
+	}
+	(*sum).mode = Float1D;
+	(*sum).width = width;
+	(*sum).height = height;
+	(*acc).frames = 0;
+	(*acc).exact = exact;
+	
+	if (exact){ //float sum is written only in finalize
+		if ((*acc).exactSum == NULL || (*acc).exactPixels < pixels){
+			if ((*acc).exactSum != NULL){ free((*acc).exactSum); }
+			(*acc).exactSum = (uint64_t*)calloc( pixels, sizeof(uint64_t) );
+			(*acc).exactPixels = pixels;
+			if ((*acc).exactSum == NULL){
+				(*acc).exactPixels = 0;
+				return -1;
 			}
-						
-			break;
 		}
-		case Gray24bpp:
-		case Gray32bpp:{
-			unsigned int *pIn;			
-			pIn = (unsigned int*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				int val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 255/(maxVal-minVal);
-			
-			pIn = (unsigned int*)(*input).data;
-			pOut = (unsigned char*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char)(((double)(*pIn++)-minVal)*range);
-			}						
-			break;
+		else{
+			memset( (*acc).exactSum, 0, pixels*sizeof(uint64_t) );
 		}
-
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:{
-			double *pIn = (double*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 255/(maxVal-minVal);
-			
-			pIn = (double*)(*input).data;
-			pOut = (unsigned char*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char) (((*pIn++)-minVal)*range);
-			}
-						
-			break;
+	}
+	
+	return 0;
+  }
+  
+  int hdrAccumulatorAdd( hdrAccumulator_t *acc, commonImage_t *image, float expTime )
+  {
+	if (acc == NULL || image == NULL || (*image).data == NULL || (*acc).sum.data == NULL) { return -2; }
+	if ((*image).width != (*acc).sum.width || (*image).height != (*acc).sum.height) { return -3; }
+	
+	int rval;
+	if ((*acc).exact){
+		if (!isExactExposureTime( expTime )) { return -2; }
+		uint64_t weight = (uint64_t)expTime;
+		rval = sumStack( image, NULL, 1, (*acc).exactSum, 0, &weight );
+	}
+	else{
+		rval = sumStack( image, &expTime, 1, (*acc).sum.data );
+	}
+	if (rval == 0) { (*acc).frames++; }
+	
+	return rval;
+  }
+  
+  typedef struct _exactToFloat{
+	hdrAccumulator_t *acc;
+	imageStats_t *rowStats; //stats of each row or NULL
+  }exactToFloat_t;
+  
+  static void exactToFloatRows( int rowStart, int rowEnd, void *ctx )
+  {
+	exactToFloat_t *conv = (exactToFloat_t*)ctx;
+	hdrAccumulator_t *acc = (*conv).acc;
+	int width = (*acc).sum.width;
+	
+	for (int y = rowStart; y < rowEnd; y++){
+		float *pOut = (float*)(*acc).sum.data + y*width;
+		const uint64_t *pIn = (*acc).exactSum + y*width;
+		for (int x = 0; x < width; x++){
+			pOut[x] = (float)pIn[x];
 		}
-		
-		case Float1D:{
-			float *pIn = (float*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				float val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 255/(maxVal-minVal);
-			
-			pIn = (float*)(*input).data;
-			pOut = (unsigned char*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char) (((*pIn++)-minVal)*range);
-			}
-						
-			break;
+		if ((*conv).rowStats != NULL){ //the row is still in cache
+			dataStats( pOut, width, &(*conv).rowStats[y] );
 		}
-		
-    } 
+	}
+  }
+  
+  int hdrAccumulatorFinalize( hdrAccumulator_t *acc, commonImage_t *output, imageStats_t *stats )
+  {
+	if (acc == NULL || output == NULL || (*acc).sum.data == NULL) { return -2; }
+	
+	if (stats != NULL) { (*stats).valid = false; }
 	
+	if ((*acc).exact){ //the only rounding of exact sum
+		std::vector<imageStats_t> rowStats;
+		exactToFloat_t conv;
+		conv.acc = acc;
+		conv.rowStats = NULL;
+		if (stats != NULL){
+			rowStats.resize( (*acc).sum.height );
+			conv.rowStats = &rowStats[0];
+		}
+		parallelRows( (*acc).sum.height, exactToFloatRows, &conv );
+		if (stats != NULL) { mergeStats( rowStats, stats ); }
+	}
+	
+	commonImage_t spare = *output; //swap buffers, the old output buffer is reused on next open 
+	*output = (*acc).sum;
+	(*acc).sum = spare;
+	(*acc).frames = 0;
 	
 	return 0;
- }
- 
+  }
+  
+  void hdrAccumulatorRelease( hdrAccumulator_t *acc )
+  {
+	if (acc == NULL) { return; }
+	if ((*acc).sum.data != NULL) { free((*acc).sum.data); }
+	if ((*acc).exactSum != NULL) { free((*acc).exactSum); }
+	(*acc).sum.data = NULL;
+	(*acc).exactSum = NULL;
+	(*acc).exactPixels = 0;
+	(*acc).frames = 0;
+  }
+  
+  bool isExactExposureTime( float expTime )
+  {
+	return expTime >= 0 && expTime < 4294967296.0f && (float)(uint64_t)expTime == expTime;
+  }
+  
   
 /************************************************************
  * Scale image data to range 0-255 
  */
- int normaliseGrayTo12bit( commonImage_t *input, commonImage_t *output )
+ int normaliseGrayTo8bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats, imageStats_t *outStats )
  {
 	int width  = (*input).width;
 	int height = (*input).height;
 	int pixels = width*height;
 	
-	double maxVal = std::numeric_limits<double>::min();
-	double minVal = std::numeric_limits<double>::max();
-	double range;
-		
 	if ((*output).data == NULL || (*output).mode != Gray8bpp || (*output).width*(*output).height < pixels ){
-		(*output).mode = Gray12bpp;
+		(*output).mode = Gray8bpp;
 		(*output).width = width;
-		(*output).height = height;		
-		(*output).data = realloc( (*output).data, pixels*sizeof(unsigned short) );
+		(*output).height = height;
+		(*output).data = realloc((*output).data, pixels*sizeof(char) );
 		if ((*output).data == NULL){
 			return -1;
-		}		
+		}	
 	}
 	
-	unsigned short *pOut = (unsigned short*)(*output).data;	
+	//float data rescaled in float (vectorized), integer and double data in double as before
+	//(8-16 bit through the exact lookup table) so that their 8 bit values are not changed
+	if ((*input).mode == Float1D){
+		normaliseOp<unsigned char, double, float> op( (unsigned char*)(*output).data, width, height, 255, std::numeric_limits<double>::min(), inStats, outStats );
+		return dispatchGray( input, op );
+	}
+	normaliseOp<unsigned char, double, double> op( (unsigned char*)(*output).data, width, height, 255, std::numeric_limits<double>::min(), inStats, outStats );
+	return dispatchGray( input, op );
+ }
+ 
+  
+/************************************************************
+ * Scale image data to range 0-255 
+ */
+ int normaliseGrayTo12bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats, imageStats_t *outStats )
+ {
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
 	
-	switch((*input).mode){
+	if ((*output).data == NULL || (*output).mode != Gray12bpp || (*output).width*(*output).height < pixels ){
+		(*output).mode = Gray12bpp;
+		(*output).width = width;
+		(*output).height = height;
+		(*output).data = realloc((*output).data, pixels*sizeof(unsigned short) );
+		if ((*output).data == NULL){
+			return -1;
+		}	
+	}
 	
-		case Gray8bpp:{
-			unsigned char *pIn;			
-			pIn = (unsigned char*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned char val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 4095/(maxVal-minVal);			
-			pIn = (unsigned char*)(*input).data;			
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned char)(((double)(*pIn++)-minVal)*range);
-			}
-			break;
-		}
-		
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn;			
-			pIn = (unsigned short*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned short val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 4095/(maxVal-minVal);
-			
-			pIn = (unsigned short*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned short)(((double)(*pIn++)-minVal)*range);
-			}
-						
-			break;
-		}
-		case Gray24bpp:
-		case Gray32bpp:{
-			unsigned int *pIn;			
-			pIn = (unsigned int*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				int val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 4095/(maxVal-minVal);
-			
-			pIn = (unsigned int*)(*input).data;
-			pOut = (unsigned short*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned short)(((double)(*pIn++)-minVal)*range);
-			}						
-			break;
-		}
-
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:{
-			double *pIn = (double*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 4095/(maxVal-minVal);
-			
-			pIn = (double*)(*input).data;
-			pOut = (unsigned short*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned short) (((*pIn++)-minVal)*range);
-			}
-						
-			break;
-		}
-		
-		case Float1D:{
-			float *pIn = (float*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				float val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 4095/(maxVal-minVal);
-			
-			pIn = (float*)(*input).data;
-			pOut = (unsigned short*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned short) (((*pIn++)-minVal)*range);
-			}
-						
-			break;
-		}
-		
-    } 
-	return 0;
+	normaliseOp<unsigned short, double, double> op( (unsigned short*)(*output).data, width, height, 4095, std::numeric_limits<double>::min(), inStats, outStats );
+	return dispatchGray( input, op );
  }
  
 /************************************************************
  * Scale data to range 32 bits uint
  */
- int normaliseGrayTo32bit( commonImage_t *input, commonImage_t *output )
+ int normaliseGrayTo32bit( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats, imageStats_t *outStats )
  {
 	int width  = (*input).width;
 	int height = (*input).height;
 	int pixels = width*height;
-			
-	double maxVal = -1;
-	double minVal = std::numeric_limits<double>::max();
-	double range;
 	
 	if ((*output).data == NULL || (*output).mode != Gray32bpp || (*output).width*(*output).height < pixels ){
 		(*output).mode = Gray32bpp;
@@ -556,131 +866,9 @@
 			return -1;
 		}	
 	}
-		
-	unsigned int *pOut = (unsigned int*)(*output).data;	
-	
-	switch((*input).mode){
-	
-		case Gray8bpp:{
-			unsigned char *pIn = (unsigned char*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned char val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = (std::numeric_limits<unsigned int>::max()-1)/(maxVal-minVal); //-1 for easing log(0) processing (allow +1
-			
-			pIn = (unsigned char*)(*input).data;
-			
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned int)(((double)(*pIn++)-minVal)*range); //floor to escape possible overflow?
-			}
-						
-			break;
-		}
-		
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn = (unsigned short*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned short val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = (std::numeric_limits<unsigned int>::max()-1)/(maxVal-minVal);
-			
-			pIn = (unsigned short*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned int)(((double)(*pIn++)-minVal)*range);				
-			}
-						
-			break;
-		}
-		case Gray24bpp:
-		case Gray32bpp:{
-			unsigned int *pIn = (unsigned int*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				int val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = (std::numeric_limits<unsigned int>::max()-1)/(maxVal-minVal);
-			
-			pIn = (unsigned int*)(*input).data;
-			pOut = (unsigned int*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (unsigned int)(((double)(*pIn++)-minVal)*range);			
-			}						
-			break;
-		}
-
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:{
-			double *pIn = (double*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}
-			
-			range = (std::numeric_limits<unsigned int>::max()-1)/(maxVal-minVal);
-	
-			pIn = (double*)(*input).data;
-			pOut = (unsigned int*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){
-				/*
-				double valD = ((*pIn++)-minVal)*range;
-				unsigned int val = (unsigned int) valD;
-				*pOut++ = val;
-				*/
-				*pOut++ = (unsigned int) (((*pIn++)-minVal)*range);				
-			}
-						
-			break;
-		}
-		
-		case Float1D:{
-			float *pIn = (float*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				float val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}
-			
-			range = (std::numeric_limits<unsigned int>::max()-1)/(maxVal-minVal);
 	
-			pIn = (float*)(*input).data;
-			pOut = (unsigned int*)(*output).data;				
-			count = pixels;
-			while(count-- > 0){			
-				*pOut++ = (unsigned int) (((*pIn++)-minVal)*range);				
-			}
-						
-			break;
-		}
-    } 
-	return 0;
+	normaliseOp<unsigned int, double, double> op( (unsigned int*)(*output).data, width, height, std::numeric_limits<unsigned int>::max()-1, -1, inStats, outStats ); //-1 for easing log(0) processing (allow +1
+	return dispatchGray( input, op );
  }
   
  /**************************************************************************
@@ -703,81 +891,234 @@ void releaseStackData( std::vector<commonImage_t> &stack )
  * find index of last image that can be used (assume increasing exp times in stack)
  * th is used to limit how under / over exposured are directly skipped
  */
-int findLastOkExposureImage( std::vector<commonImage_t> &stack , double th)
-{		
-	int   hist[256];
-	double cdf[256];
-	int idx = -1; //No over exposed found neg!
-	
-	std::vector<commonImage_t>::iterator image = stack.end();
-
-	commonImage_t imBuf;
-		
-	while ( --image > stack.begin() ){
-
-		for(int i=0;i<256;i++){ 
-			cdf[i]=0;	
-			hist[i]=0;	
-		}		
+static commonImage_t* stackImage( int id, void *ctx )
+{
+	return &(*(std::vector<commonImage_t>*)ctx)[id];
+}
 
-		normaliseGrayTo8bit( &(*image), &imBuf );
+int findLastOkExposureImage( std::vector<commonImage_t> &stack , double th, int rowStep)
+{		
+	return findLastOkExposure( stack.size(), stackImage, &stack, th, rowStep );
+}
 
-		int count = imBuf.width*imBuf.height;
-		unsigned char *ptD = (unsigned char *)imBuf.data;		
-		while( count-- > 0){
-			hist[ (*ptD++) ]++;
+/********************************************************************************
+ * 256 bin histogram of image as normaliseGrayTo8bit would scale it. For 8-16 bit
+ * data computed directly in single pass: histogram of native values (nativeHist 
+ * has room for 65536 bins) gives min and max and is then mapped to 256 bins. 
+ * Only every rowStep:th row is used. 
+ */
+static void histogram8bit( commonImage_t *image, int rowStep, unsigned int *nativeHist, int *hist, commonImage_t *imBuf )
+{
+	int width  = (*image).width;
+	int height = (*image).height;
+	int nLevels = 0;
+	
+	for(int i=0;i<256;i++){ hist[i]=0; }
+	if (rowStep < 1) { rowStep = 1; }
+	
+	switch((*image).mode){
+		case Gray8bpp:
+			nLevels = 256;
+			break;
+		case Gray10bpp:
+		case Gray12bpp:
+		case Gray14bpp:
+		case Gray16bpp:
+			nLevels = 65536;
+			break;
+		default:
+			break;
+	}
+	
+	if (nLevels == 0){ //no native histogram for 32 bit / floating point data
+		normaliseGrayTo8bit( image, imBuf );
+		for (int r = 0; r < height; r += rowStep){
+			unsigned char *ptD = (unsigned char *)(*imBuf).data + r*width;
+			int count = width;
+			while( count-- > 0){
+				hist[ (*ptD++) ]++;
+			}
 		}
-						
-		cdf[0] = hist[0];		
-		for(int i=1;i<256;i++){ 
-			cdf[i] = cdf[i-1] + hist[i];				
+		return;
+	}
+	
+	memset( nativeHist, 0, nLevels*sizeof(unsigned int) );
+	for (int r = 0; r < height; r += rowStep){
+		int count = width;
+		if (nLevels == 256){
+			unsigned char *pIn = (unsigned char*)(*image).data + r*width;
+			while( count-- > 0){ nativeHist[ *pIn++ ]++; }
 		}
-		
-		for(int i=0;i<256;i++){ 
-			cdf[i]/=cdf[255]; //Would be enough id 0 254 255?
-			if ( isnan(cdf[i]) )
-				cdf[i] = 0;
-			if ( isinf(cdf[i]) )
-				cdf[i] = 1;
-		}		
+		else{
+			unsigned short *pIn = (unsigned short*)(*image).data + r*width;
+			while( count-- > 0){ nativeHist[ *pIn++ ]++; }
+		}
+	}
 	
-		//std::cout << "DBG 0:" << cdf[0] << " 254:" << cdf[254] <<" 255:" <<  cdf[255] << std::endl;
-		
-		if ( cdf[0] > 0.99 || cdf[254] < 0.01 ){ //About black/white image
-			image--;
-			//std::cout << "DBG ID:" << image - stack.begin()  << " skipped" << std::endl;
-			continue;
+	int minVal = 0;
+	while (minVal < nLevels-1 && nativeHist[minVal] == 0) { minVal++; }
+	int maxVal = nLevels-1;
+	while (maxVal > minVal && nativeHist[maxVal] == 0) { maxVal--; }
+	
+	if (maxVal == minVal){ //flat image
+		hist[0] = nativeHist[minVal];
+		return;
+	}
+	
+	double range = 255/((double)maxVal-minVal);	//as in normaliseGrayTo8bit
+	for (int v = minVal; v <= maxVal; v++){
+		if (nativeHist[v] > 0){
+			hist[ (unsigned char)(((double)v-minVal)*range) ] += nativeHist[v];
 		}
-		
-		//A bit shorter than Matlab version (no max gradient for sum) (maybe good - maybe not :: TODO test)
-		if ( cdf[254] < th ){
-			idx = image - stack.begin() +1; 
-			//std::cout << "DBG MAX idx:"  << idx << std::endl;	
-			if (cdf[254] > 0.5)
-				break;
-		}		
-
-		image--;	
 	}
+}
 
-	if( imBuf.data != NULL ) { free(imBuf.data); }	
+/********************************************************************************
+ * cdf[0] and cdf[254] of the image histogram (as 8 bit normalised)
+ */
+static void exposureCdf( commonImage_t *image, int rowStep, unsigned int *nativeHist, commonImage_t *imBuf, 
+						 double *cdfLow, double *cdfHigh )
+{
+	int   hist[256];
+	double cdf[256];
+	
+	histogram8bit( image, rowStep, nativeHist, hist, imBuf );
+					
+	cdf[0] = hist[0];		
+	for(int i=1;i<256;i++){ 
+		cdf[i] = cdf[i-1] + hist[i];				
+	}
 
-	return idx;
+	for(int i=0;i<256;i++){ 
+		cdf[i]/=cdf[255]; //Would be enough id 0 254 255?
+		if ( isnan(cdf[i]) )
+			cdf[i] = 0;
+		if ( isinf(cdf[i]) )
+			cdf[i] = 1;
+	}		
+	//std::cout << "DBG 0:" << cdf[0] << " 254:" << cdf[254] <<" 255:" <<  cdf[255] << std::endl;
+	
+	*cdfLow  = cdf[0];
+	*cdfHigh = cdf[254];
 }
 
-/************************************************************************
- * Scale data from input to range [0 1] in output
+/********************************************************************************
+ * One step of the walk from the last image down (sets idx if image ok)
+ * return true if the walk can be stopped
  */
- int normaliseGrayToDouble( commonImage_t *input, commonImage_t *output ) 
- {
-	int width  = (*input).width;
-	int height = (*input).height;
-	int pixels = width*height;
-			
-	//double maxVal = -1;
-	double maxVal = std::numeric_limits<double>::min();
-	double minVal = std::numeric_limits<double>::max();
-	double range;
+static bool exposureWalkStep( int id, double cdfLow, double cdfHigh, double th, int *idx )
+{
+	if ( cdfLow > 0.99 || cdfHigh < 0.01 ){ //About black/white image
+		//std::cout << "DBG ID:" << id  << " skipped" << std::endl;
+		return false;
+	}
+	
+	//A bit shorter than Matlab version (no max gradient for sum) (maybe good - maybe not :: TODO test)
+	if ( cdfHigh < th ){
+		*idx = id +1; 
+		//std::cout << "DBG MAX idx:"  << idx << std::endl;	
+		if (cdfHigh > 0.5)
+			return true;
+	}		
+	return false;
+}
+
+int findLastOkExposure( int stackSize, stackLoader_t loadImage, void *ctx, double th, int rowStep)
+{
+	int idx = -1; //No over exposed found neg!
+	double cdfLow, cdfHigh;
+	
+	commonImage_t imBuf;
+	unsigned int *nativeHist = (unsigned int*)malloc(65536*sizeof(unsigned int));
+	if (nativeHist == NULL) { return -1; }
+		
+	//OBS every second image is tested starting from the last one 
+	for ( int id = stackSize-1; id > 0; id -= 2 ){
+
+		commonImage_t *image = loadImage( id, ctx );
+		if (image == NULL) { continue; }
+
+		exposureCdf( image, rowStep, nativeHist, &imBuf, &cdfLow, &cdfHigh );
+		
+		if ( exposureWalkStep( id, cdfLow, cdfHigh, th, &idx ) ){
+			break;
+		}
+	}
+
+	if( imBuf.data != NULL ) { free(imBuf.data); }	
+	free(nativeHist);
+
+	return idx;
+}
+
+/********************************************************************************
+ * Exposure check with images given in increasing exposure order
+ */
+int exposureSelectorOpen( exposureSelector_t *sel, int stackSize, double th, int rowStep )
+{
+	if (sel == NULL || stackSize < 1) { return -2; }
+	
+	if ((*sel).nativeHist == NULL){
+		(*sel).nativeHist = (unsigned int*)malloc(65536*sizeof(unsigned int));
+		if ((*sel).nativeHist == NULL) { return -1; }
+	}
+	(*sel).stackSize = stackSize;
+	(*sel).th = th;
+	(*sel).rowStep = rowStep;
+	(*sel).tested.assign( stackSize, false );
+	(*sel).cdfLow.assign( stackSize, 0 );
+	(*sel).cdfHigh.assign( stackSize, 0 );
+	
+	return 0;
+}
+
+int exposureSelectorAdd( exposureSelector_t *sel, int id, commonImage_t *image )
+{
+	if (sel == NULL || image == NULL || id < 0 || id >= (*sel).stackSize) { return -2; }
+	
+	//same images as in findLastOkExposure walk
+	if ( id == 0 || ((*sel).stackSize-1-id) % 2 != 0 ){ return 0; }
+	
+	exposureCdf( image, (*sel).rowStep, (*sel).nativeHist, &(*sel).imBuf, &(*sel).cdfLow[id], &(*sel).cdfHigh[id] );
+	(*sel).tested[id] = true;
+	
+	//With th <= 0.5 the walk never stops early and the lowest ok image gives the result 
+	int idx = -1;
+	exposureWalkStep( id, (*sel).cdfLow[id], (*sel).cdfHigh[id], (*sel).th, &idx );
+	
+	return ( (*sel).th <= 0.5 && idx >= 0 ) ? 1 : 0;
+}
+
+int exposureSelectorResult( exposureSelector_t *sel )
+{
+	int idx = -1;
+	
+	for ( int id = (*sel).stackSize-1; id > 0; id -= 2 ){
+		if ( !(*sel).tested[id] ) { continue; }
+		if ( exposureWalkStep( id, (*sel).cdfLow[id], (*sel).cdfHigh[id], (*sel).th, &idx ) ){
+			break;
+		}
+	}
+	return idx;
+}
+
+void exposureSelectorRelease( exposureSelector_t *sel )
+{
+	if (sel == NULL) { return; }
+	if ((*sel).nativeHist != NULL) { free((*sel).nativeHist); }
+	if ((*sel).imBuf.data != NULL) { free((*sel).imBuf.data); }
+	(*sel).nativeHist = NULL;
+	(*sel).imBuf.data = NULL;
+}
+
+/************************************************************************
+ * Scale data from input to range [0 1] in output
+ */
+ int normaliseGrayToDouble( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats, imageStats_t *outStats ) 
+ {
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
 	
 	if ((*output).data == NULL || (*output).mode != Double1D || (*output).width*(*output).height < pixels ){
 		(*output).mode = Double1D;
@@ -788,511 +1129,1122 @@ int findLastOkExposureImage( std::vector<commonImage_t> &stack , double th)
 			return -1;
 		}	
 	}
-		
-	double *pOut = (double*)(*output).data;	
 	
-	switch((*input).mode){
+	normaliseOp<double, double, double> op( (double*)(*output).data, width, height, 1.0, std::numeric_limits<double>::min(), inStats, outStats );
+	return dispatchGray( input, op );
+ }
+ 
+ 
+/************************************************************************
+ * Scale data from input to range [0 1] in output
+ */
+ int normaliseGrayToFloat( commonImage_t *input, commonImage_t *output, const imageStats_t *inStats, imageStats_t *outStats ) 
+ {
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
 	
-		case Gray8bpp:{
-			unsigned char *pIn = (unsigned char*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned char val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 1.0/(maxVal-minVal);
-			
-			pIn = (unsigned char*)(*input).data;
+	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
+		(*output).mode = Float1D;
+		(*output).width = width;
+		(*output).height = height;
+		(*output).data = realloc((*output).data, pixels*sizeof(float) );
+		if ((*output).data == NULL){
+			return -1;
+		}	
+	}
+	
+	normaliseOp<float, float, float> op( (float*)(*output).data, width, height, 1.0, std::numeric_limits<float>::min(), inStats, outStats );
+	return dispatchGray( input, op );
+ }
+ 
+
+/**
+ * out[i] = log(1+in[i]) with logf or with the fast approximation (log1pF32) 
+ */
+static void log1pRow( const float *in, float *out, int count, bool fast )
+{
+	if (fast){
+		log1pF32( in, out, count ); //explicitly vectorized (simdKernels.h)
+		return;
+	}
+	for (int i = 0; i < count; i++){
+		out[i] = logf( 1 + in[i] );
+	}
+}
+
+/********************************************************************************
+ * Multiscale Retinex with the true Gaussian scales (recursive Gaussian filter or
+ * box filter cascade)
+ */
+static int multiscaleRetinexGaussScales( commonImage_t *input, commonImage_t *output, imageStats_t *stats, bool fastLog, 
+                                         retinexLowPass_e lowPass, const retinexParams_t *par )
+{
+	if (input==NULL || (*input).data == NULL || (*input).mode != Float1D) { return -2; }
+	if ((*par).scales < 1 || (*par).scales > RETINEX_MAX_SCALES) { return -2; }
+	
+	const int nScales = (*par).scales;
+	const float *sigmas = (*par).sigma;
+	
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
+
+	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
+		(*output).data = realloc((*output).data, pixels*sizeof(float) );
+		if ((*output).data == NULL){
+			return -1;
+		}	
+	}		
+	(*output).mode = Float1D;
+	(*output).width = width;
+	(*output).height = height;
+
+	//buffers
+	commonImage_t imgF1(Float1D, width, height, malloc(pixels*sizeof(float)));	
+	commonImage_t imgFlog(Float1D, width, height, malloc(pixels*sizeof(float)));	
+	if (imgF1.data == NULL || imgFlog.data == NULL){ 
+		free(imgF1.data);
+		free(imgFlog.data);
+		return -1; 
+	}
+
+	float *pLog = (float*)imgFlog.data;
+	log1pRow( (float*)(*input).data, pLog, pixels, fastLog );
+	
+	int rval = 0;
+	std::vector<imageStats_t> rowStats( stats != NULL ? height : 0 );
+	
+	for (int scale = 0; scale < nScales && rval == 0; scale++){
+		if (lowPass == RETINEX_LP_BOX) { rval = gaussianBox_Float( input, &imgF1, sigmas[scale] ); }
+		else                           { rval = gaussianRecursive_Float( input, &imgF1, sigmas[scale] ); }
+		
+		for (int y = 0; y < height; y++){
+			float *pLP  = (float*)imgF1.data + y*width;	//LP filtered data	
+			float *pL   = pLog + y*width;					//log of input	
+			float *pOut = (float*)(*output).data + y*width;
 			
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((double)(*pIn++)-minVal)*range); //floor to escape possible overflow?
+			log1pRow( pLP, pLP, width, fastLog );
+			float fact = (*par).weight[scale];
+			if (scale == 0){
+				for (int x = 0; x < width; x++){ pOut[x]  = (pL[x] - pLP[x])*fact; }
 			}
+			else{
+				for (int x = 0; x < width; x++){ pOut[x] += (pL[x] - pLP[x])*fact; }
+			}
+			if (stats != NULL && scale == nScales-1){ 
+				dataStats( pOut, width, &rowStats[y] ); 
+			}
+		}
+	}
+	if (stats != NULL) { 
+		mergeStats( rowStats, stats ); 
+		(*stats).valid = (*stats).valid && rval == 0;
+	}
+	
+	free(imgF1.data);
+	free(imgFlog.data);
+	return rval;
+}
 
-			break;
+int multiscaleRetinexFilterGauss( commonImage_t *input, commonImage_t *output, imageStats_t *stats, bool fastLog )
+{
+	retinexParams_t par;
+	return multiscaleRetinexGaussScales( input, output, stats, fastLog, RETINEX_LP_RECURSIVE, &par );
+}
+
+/********************************************************************************
+ * Retinex kernels: normalised Gaussians sampled in the window as fspecial('gaussian')
+ */
+int retinexKernelsOpen( retinexKernels_t *ker, const retinexParams_t *par )
+{
+	if (ker == NULL || par == NULL) { return -2; }
+	
+	int nScales = (*par).scales;
+	int k = (*par).window;
+	if (nScales < 1 || nScales > RETINEX_MAX_SCALES || k < 1 || (k & 1) == 0) { return -2; }
+	for (int s = 0; s < nScales; s++){
+		if (!((*par).sigma[s] > 0)) { return -2; }
+	}
+	
+	(*ker).params = *par;
+	(*ker).H.assign( nScales*k*k, 0 );
+	(*ker).Hx.assign( nScales*k, 0 );
+	(*ker).Hy.assign( nScales*k, 0 );
+	(*ker).separable = true;
+	
+	double decimalScale = pow( 10.0, (*par).decimals );
+	std::vector<double> g( k*k );
+	for (int s = 0; s < nScales; s++){
+		double sigma = (*par).sigma[s];
+		double sum = 0;
+		for (int r = 0; r < k; r++){
+			for (int c = 0; c < k; c++){
+				double dr = r - k/2, dc = c - k/2;
+				g[r*k + c] = exp( -(dr*dr + dc*dc)/(2*sigma*sigma) );
+				sum += g[r*k + c];
+			}
+		}
+		float *H = &(*ker).H[s*k*k];
+		for (int i = 0; i < k*k; i++){
+			double v = g[i]/sum;
+			if ((*par).decimals > 0) { v = floor( v*decimalScale + 0.5 )/decimalScale; } //as printf (%f for 6)
+			H[i] = (float)v;
+		}
+		(*ker).separable = (*ker).separable && separateKernel( H, k, &(*ker).Hx[s*k], &(*ker).Hy[s*k] );
+	}
+	return 0;
+}
+
+void retinexKernelsRelease( retinexKernels_t *ker )
+{
+	std::vector<float>().swap( (*ker).H );
+	std::vector<float>().swap( (*ker).Hx );
+	std::vector<float>().swap( (*ker).Hy );
+	(*ker).separable = false;
+}
+
+/********************************************************************************
+ * Multiscale Retinex filtering (a sort of)
+ *  (here expect image on range [0 1]
+ * 
+ * All scales are computed in one pass over the image: each band of rows keeps the 
+ * row filtered input rows of the kernel window (per scale) in a ring buffer, filters 
+ * the columns of the window to get the low pass rows and writes the final retinex 
+ * row. The arithmetic is the same as with separate convolutions (sums in the same 
+ * order) so the result does not change, only the full frame buffers are gone.
+ * Without output only the row sums are kept (the retinex rows are not stored at all).
+ */
+typedef struct _retinexFused{
+	const float *in;
+	float *out;                                //NULL if only the row sums are needed
+	int width;
+	int height;
+	int scales;
+	int ksize;                                 //kernel window
+	const float *weight;                       //of each scale
+	const float *H;                            //2D kernels (used if not separable)
+	const float *Hx;
+	const float *Hy;
+	bool separable;
+	imageStats_t *rowStats;                    //per row stats, NULL if not needed (needs out)
+	double *rowSums;                           //sum of each row (valid part), NULL if not needed
+	bool fastLog;                              //log1pF32 instead of logf
+	int error;
+}retinexFused_t;
+
+//row r of input filtered with Hx of each scale to its ring slot (as convolutionSeparable_Float rows)
+static void retinexFilterRow( const retinexFused_t *f, int r, float *ring, int xe )
+{
+	const int ksize = (*f).ksize;
+	const float *pIn = (*f).in + r*(*f).width;
+	for (int s = 0; s < (*f).scales; s++){
+		float *pTmp = ring + (s*ksize + r%ksize)*xe;
+		for (int c = 0; c < xe; c++){ pTmp[c] = 0; }
+		for (int k = 0; k < ksize; k++){
+			float h = (*f).Hx[s*ksize + k];
+			const float *pk = pIn + k;
+			for (int c = 0; c < xe; c++){
+				pTmp[c] += h * pk[c];
+			}
+		}
+	}
+}
+
+//low pass row y of each scale from the ring (separable) or directly from input (as convolution2D_Float)
+static void retinexLowPassRow( const retinexFused_t *f, int y, const float *ring, float *lp, int xe )
+{
+	const int ksize = (*f).ksize;
+	const int ys = ksize>>1;
+	for (int s = 0; s < (*f).scales; s++){
+		float *pLP = lp + s*xe;
+		if ((*f).separable){
+			for (int c = 0; c < xe; c++){ pLP[c] = 0; }
+			for (int k = 0; k < ksize; k++){
+				float h = (*f).Hy[s*ksize + k];
+				const float *pTmp = ring + (s*ksize + (y-ys+k)%ksize)*xe;
+				for (int c = 0; c < xe; c++){
+					pLP[c] += h * pTmp[c];
+				}
+			}
 		}
+		else{
+			for (int c = 0; c < xe; c++){
+				float val = 0;
+				for (int rid = 0; rid < ksize; rid++){
+					const float *pH  = (*f).H + (s*ksize + rid)*ksize;
+					const float *pIn = (*f).in + (y-ys+rid)*(*f).width + c;
+					float rval = 0;
+					for (int cid = 0; cid < ksize; cid++){
+						rval += pH[cid] * pIn[cid];
+					}
+					val += rval;
+				}
+				pLP[c] = val;
+			}
+		}
+	}
+}
+
+static void retinexFusedRows( int rowStart, int rowEnd, void *ctx )
+{
+	retinexFused_t *f = (retinexFused_t*)ctx;
+	const int scales = (*f).scales;
+	const int border = (*f).ksize>>1;
+	int width  = (*f).width;
+	int height = (*f).height;
+	int xe = width - 2*border;
+	
+	float *ring = (float*)malloc( scales*(*f).ksize*xe*sizeof(float) );
+	float *lp   = (float*)malloc( (scales+1)*xe*sizeof(float) ); //low pass rows and log of input
+	if (ring == NULL || lp == NULL){
+		(*f).error = -1;
+		free(ring);
+		free(lp);
+		return;
+	}
+	float *logIn = lp + scales*xe;
+	
+	int next = (rowStart > border ? rowStart : border) - border; //next input row to be row filtered
+	
+	for (int y = rowStart; y < rowEnd; y++){
+		float *pOut = (*f).out != NULL ? (*f).out + y*width : NULL;
 		
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn = (unsigned short*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned short val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 1.0/(maxVal-minVal);
+		if (y < border || y >= height-border){
+			if (pOut != NULL) { memset( pOut, 0, width*sizeof(float) ); }
+		}
+		else{
+			if ((*f).separable){
+				for (; next <= y+border; next++){
+					retinexFilterRow( f, next, ring, xe );
+				}
+			}
+			retinexLowPassRow( f, y, ring, lp, xe );
+			log1pRow( lp, lp, scales*xe, (*f).fastLog );
+			log1pRow( (*f).in + y*width + border, logIn, xe, (*f).fastLog );
 			
-			pIn = (unsigned short*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((double)(*pIn++)-minVal)*range);				
+			float *pO = pOut != NULL ? pOut + border : lp; //(the first low pass row is used only here)
+			const float fact = (*f).weight[0];
+			for (int c = 0; c < xe; c++){
+				pO[c] = (logIn[c] - lp[c])*fact;
+			}
+			for (int s = 1; s < scales; s++){
+				const float *pLP = lp + s*xe;
+				const float w = (*f).weight[s];
+				for (int c = 0; c < xe; c++){
+					pO[c] += (logIn[c] - pLP[c])*w;
+				}
+			}
+			if ((*f).rowSums != NULL){
+				double sum = 0;
+				for (int c = 0; c < xe; c++){ sum += pO[c]; }
+				(*f).rowSums[y] = sum;
+			}
+			if (pOut != NULL){
+				for (int x = 0; x < border; x++){
+					pOut[x] = 0;
+					pOut[width-1-x] = 0;
+				}
 			}
-						
-			break;
 		}
-		case Gray24bpp:
-		case Gray32bpp:{
-			unsigned int *pIn = (unsigned int*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				int val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = 1.0/(maxVal-minVal);
-			
-			pIn = (unsigned int*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((double)(*pIn++)-minVal)*range);			
-			}						
-			break;
+		if ((*f).rowStats != NULL){ 
+			dataStats( pOut, width, &(*f).rowStats[y] ); 
 		}
+	}
+	
+	free(ring);
+	free(lp);
+}
 
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:{
-			double *pIn = (double*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
+//the fused pass to out (if not NULL) and/or the row sums of its valid part (if not NULL)
+static int retinexFusedPass( commonImage_t *input, float *out, imageStats_t *rowStats, double *rowSums, bool fastLog, 
+                             const retinexKernels_t *kernels )
+{
+	retinexFused_t f;
+	f.in  = (float*)(*input).data;
+	f.out = out;
+	f.width  = (*input).width;
+	f.height = (*input).height;
+	f.scales = (*kernels).params.scales;
+	f.ksize  = (*kernels).params.window;
+	f.weight = (*kernels).params.weight;
+	f.H  = &(*kernels).H[0];
+	f.Hx = &(*kernels).Hx[0];
+	f.Hy = &(*kernels).Hy[0];
+	f.separable = (*kernels).separable;
+	f.rowStats = rowStats;
+	f.rowSums = rowSums;
+	f.fastLog = fastLog;
+	f.error = 0;
+	
+	parallelRows( f.height, retinexFusedRows, &f );
+	return f.error;
+}
+
+int multiscaleRetinexFilter( commonImage_t *input, commonImage_t *output, imageStats_t *stats, bool fastLog, retinexLowPass_e lowPass,
+                             const retinexKernels_t *kernels )
+{
+	if (input==NULL || (*input).data == NULL) { return -2; }
+	if (lowPass != RETINEX_LP_KERNEL) { 
+		retinexParams_t par;
+		return multiscaleRetinexGaussScales( input, output, stats, fastLog, lowPass, kernels != NULL ? &(*kernels).params : &par ); 
+	}
+	
+	retinexKernels_t defKernels;
+	if (kernels == NULL){
+		retinexParams_t par;
+		retinexKernelsOpen( &defKernels, &par );
+		kernels = &defKernels;
+	}
+	int ksize = (*kernels).params.window;
+	if ((*kernels).H.empty()) { return -2; }
+
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
+	if (width < ksize || height < ksize) { return -2; }
+
+	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
+		(*output).mode = Float1D;
+		(*output).width = width;
+		(*output).height = height;
+		(*output).data = realloc((*output).data, pixels*sizeof(float) );
+		if ((*output).data == NULL){
+			return -1;
+		}	
+	}		
+
+	std::vector<imageStats_t> rowStats( stats != NULL ? height : 0 );
+	int rval = retinexFusedPass( input, (float*)(*output).data, stats != NULL ? &rowStats[0] : NULL, NULL, fastLog, kernels );
+	
+	if (stats != NULL) { 
+		mergeStats( rowStats, stats ); 
+		(*stats).valid = (*stats).valid && rval == 0;
+	}
+	return rval;
+}
+
+int retinexProjectionGradient( commonImage_t *input, std::vector<float> &feature, bool fastLog, retinexLowPass_e lowPass,
+                               const retinexKernels_t *kernels )
+{
+	if (input==NULL || (*input).data == NULL || (*input).mode != Float1D) { return -2; }
+	
+	int width  = (*input).width;
+	int height = (*input).height;
+	std::vector<double> rowSums( height, 0 );
+	int first = 0, last = height; //rows of the valid part
+	int rval;
+	
+	if (lowPass != RETINEX_LP_KERNEL){ //full Gaussians, the retinex image is needed for them anyway
+		commonImage_t res;
+		rval = multiscaleRetinexFilter( input, &res, NULL, fastLog, lowPass, kernels );
+		for (int y = 0; y < height && rval == 0; y++){
+			const float *pRow = (float*)res.data + y*width;
+			double sum = 0;
+			for (int x = 0; x < width; x++){ sum += pRow[x]; }
+			rowSums[y] = sum;
+		}
+		free(res.data);
+	}
+	else{
+		retinexKernels_t defKernels;
+		if (kernels == NULL){
+			retinexParams_t par;
+			retinexKernelsOpen( &defKernels, &par );
+			kernels = &defKernels;
+		}
+		int ksize = (*kernels).params.window;
+		if ((*kernels).H.empty() || width < ksize || height < ksize) { return -2; }
+		
+		first = ksize>>1;
+		last = height - first;
+		rval = retinexFusedPass( input, NULL, NULL, &rowSums[0], fastLog, kernels );
+	}
+	if (rval != 0) { return rval; }
+	if (last - first < 2) { return -2; }
+	
+	//absolute differences of the y-projection normalised with their max
+	feature.resize( last-first-1 );
+	double maxDiff = 0;
+	for (int y = first; y < last-1; y++){
+		double diff = fabs( rowSums[y+1] - rowSums[y] );
+		if (diff > maxDiff) { maxDiff = diff; }
+	}
+	for (int y = first; y < last-1; y++){
+		double diff = fabs( rowSums[y+1] - rowSums[y] );
+		feature[y-first] = maxDiff > 0 ? (float)(diff/maxDiff) : 0;
+	}
+	return 0;
+}
+
+/**
+ * Factor a kernel to column and row kernels H = Hy*Hx^T (rank-1 within tol)
+ *  The row and column through the largest kernel value are used for the factors.
+ */
+bool separateKernel( const float *H, unsigned int Hsize, float *Hx, float *Hy, float tol )
+{
+	if (H == NULL || Hx == NULL || Hy == NULL || Hsize == 0) { return false; }
+	
+	unsigned int pivot = 0;
+	for (unsigned int i = 1; i < Hsize*Hsize; i++){
+		if (fabs(H[i]) > fabs(H[pivot])) { pivot = i; }
+	}
+	double maxVal = fabs(H[pivot]);
+	if (maxVal == 0) { return false; }
+	
+	unsigned int pr = pivot / Hsize;
+	unsigned int pc = pivot % Hsize;
+	std::vector<double> u(Hsize), v(Hsize);
+	for (unsigned int i = 0; i < Hsize; i++){
+		u[i] = H[i*Hsize + pc];                    //column through pivot
+		v[i] = H[pr*Hsize + i] / H[pivot];         //row through pivot (scaled)
+	}
+	
+	for (unsigned int r = 0; r < Hsize; r++){
+		for (unsigned int c = 0; c < Hsize; c++){
+			if (fabs(H[r*Hsize + c] - u[r]*v[c]) > tol*maxVal) { return false; }
+		}
+	}
+	
+	for (unsigned int i = 0; i < Hsize; i++){
+		Hy[i] = (float)u[i];
+		Hx[i] = (float)v[i];
+	}
+	return true;
+}
+
+/**
+ * Separable convolution: rows with Hx to a temporary image then its columns with Hy 
+ *  (2*Hsize multiply-adds per pixel). Only the area valid for the full kernel is 
+ *  written to output as in convolution2D_Float. 
+ */
+int convolutionSeparable_Float( commonImage_t *input, commonImage_t *output, const float *Hx, const float *Hy, unsigned int Hsize, bool zeroBorders )
+{
+	if (input == NULL || output == NULL || (*input).data == NULL || (*output).data == NULL || Hx == NULL || Hy == NULL) { return -2; }
+	
+	int imWidth  = (*input).width;
+	int imHeight = (*input).height;
+	int xs = Hsize>>1; 
+	int ys = Hsize>>1; 
+	int xe = imWidth-(xs*2);  //number of valid columns
+	if (xe <= 0 || imHeight-ys <= ys) { return -2; }
+	
+	float *tmp = (float*)malloc( sizeof(float)*xe*imHeight ); //row filtered valid columns
+	if (tmp == NULL) { return -1; }
+	
+	//rows: tmp[r][c] = sum_k Hx[k]*in[r][c+k]
+	for (int r = 0; r < imHeight; r++){
+		const float *pIn = (float*)(*input).data + r*imWidth;
+		float *pTmp = tmp + r*xe;
+		for (int c = 0; c < xe; c++){ pTmp[c] = 0; }
+		for (unsigned int k = 0; k < Hsize; k++){
+			float h = Hx[k];
+			const float *pk = pIn + k;
+			for (int c = 0; c < xe; c++){
+				pTmp[c] += h * pk[c];
 			}
-			
-			range = 1.0/(maxVal-minVal);
+		}
+	}
 	
-			pIn = (double*)(*input).data;
-			count = pixels;
-			while(count-- > 0){		
-				*pOut++ = (((*pIn++)-minVal)*range);				
+	//columns: out[r][c+xs] = sum_k Hy[k]*tmp[r-ys+k][c]
+	for (int r = ys; r < imHeight-ys; r++){
+		float *pOut = (float*)(*output).data + r*imWidth + xs;
+		for (int c = 0; c < xe; c++){ pOut[c] = 0; }
+		for (unsigned int k = 0; k < Hsize; k++){
+			float h = Hy[k];
+			const float *pTmp = tmp + (r-ys+k)*xe;
+			for (int c = 0; c < xe; c++){
+				pOut[c] += h * pTmp[c];
 			}
-						
-			break;
 		}
-		
-		case Float1D:{
-			float *pIn = (float*)(*input).data;			
-			int count = pixels;
-			while(count-- > 0){
-				float val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}			
-			range = 1.0/(maxVal-minVal);	
-			pIn = (float*)(*input).data;
-			count = pixels;
-			while(count-- > 0){		
-				*pOut++ = (((double)(*pIn++)-minVal)*range);				
-			}
-						
-			break;
+	}
+	
+	free( tmp );
+	
+	if(zeroBorders){
+		setBordersTo( output, xs, 0);
+	}		
+	
+	return 0;
+}
+
+/**
+ * Recursive Gaussian (Young & van Vliet 1995): a causal and an anti-causal 3rd order
+ *  filter run over rows and then over columns. 
+ *    forward:  w[n] = B*x[n] + a1*w[n-1] + a2*w[n-2] + a3*w[n-3]
+ *    backward: y[n] = B*w[n] + a1*y[n+1] + a2*y[n+2] + a3*y[n+3]
+ *  With large sigma B is small (3e-7 for sigma 250) and the rounding errors of the 
+ *  state are amplified by 1/B so the filtering is done in double.
+ *  The image is taken to continue with its edge values: the forward state starts from 
+ *  the first value (steady state) and the backward state from M*(forward end state - 
+ *  last value) + last value as in
+ *    "Boundary conditions for Young-van Vliet recursive filtering" Bill Triggs, Michael Sdika
+ *    IEEE Trans. Signal Processing 54(6) 2006
+ *  M is computed here by running the filters over a long tail for unit end states.
+ */
+typedef struct _recursiveGauss{
+	double B, a1, a2, a3;
+	double M[3][3]; //backward start state (y[n+1], y[n+2], y[n+3]) from forward end state (w[n], w[n-1], w[n-2])
+	const float *in;
+	float *out;
+	double *tmp;    //row filtered image
+	int width;
+	int height;
+}recursiveGauss_t;
+
+static void recursiveGaussCoefs( double sigma, recursiveGauss_t *g )
+{
+	//poles of the 3rd order approximation scaled with q; the polynomial is expanded here 
+	//since the rounded b0..b3 constants of the paper do not sum right with large q
+	const double m0 = 1.16680, m1 = 1.10783, m2 = 1.40586;
+	double q = (sigma >= 2.5) ? 0.98711*sigma - 0.96330 : 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+	double A = m0 + q;
+	double C = m1 + q;
+	double E = C*C + m2*m2;
+	double b0 = A*E;
+	
+	(*g).a1 = (2*A*C*q + q*E)/b0;
+	(*g).a2 = -(A + 2*C)*q*q/b0;
+	(*g).a3 = q*q*q/b0;
+	(*g).B  = m0*(m1*m1 + m2*m2)/b0; //= 1-(a1+a2+a3), unit gain
+	
+	//the tail decays as (1-1/q)^n or faster
+	int tail = (int)(40*q) + 100;
+	std::vector<double> w( tail+3 );
+	for (int j = 0; j < 3; j++){
+		for (int n = 0; n < 3; n++) { w[n] = (n == 2-j) ? 1 : 0; } //w[2] is the last forward value
+		for (int n = 3; n < tail+3; n++){
+			w[n] = (*g).a1*w[n-1] + (*g).a2*w[n-2] + (*g).a3*w[n-3]; //input zero after the end
+		}
+		double y1 = 0, y2 = 0, y3 = 0;
+		for (int n = tail+2; n >= 3; n--){
+			double v = (*g).B*w[n] + (*g).a1*y1 + (*g).a2*y2 + (*g).a3*y3;
+			y3 = y2; y2 = y1; y1 = v;
+		}
+		(*g).M[0][j] = y1;
+		(*g).M[1][j] = y2;
+		(*g).M[2][j] = y3;
+	}
+}
+
+//backward start state (y1, y2, y3) from forward end state (w1, w2, w3) with edge value xe
+static inline void recursiveGaussEnd( const recursiveGauss_t *g, double xe, double w1, double w2, double w3, double *y )
+{
+	for (int i = 0; i < 3; i++){
+		y[i] = xe + (*g).M[i][0]*(w1-xe) + (*g).M[i][1]*(w2-xe) + (*g).M[i][2]*(w3-xe);
+	}
+}
+
+static void recursiveGaussRows( int rowStart, int rowEnd, void *ctx )
+{
+	recursiveGauss_t *g = (recursiveGauss_t*)ctx;
+	const double B = (*g).B, a1 = (*g).a1, a2 = (*g).a2, a3 = (*g).a3;
+	int width = (*g).width;
+	
+	for (int r = rowStart; r < rowEnd; r++){
+		const float *x = (*g).in + r*width;
+		double *w = (*g).tmp + r*width;
+		
+		double w1 = x[0], w2 = x[0], w3 = x[0];
+		for (int n = 0; n < width; n++){
+			double v = B*x[n] + a1*w1 + a2*w2 + a3*w3;
+			w[n] = v; 
+			w3 = w2; w2 = w1; w1 = v;
+		}
+		
+		double y[3];
+		recursiveGaussEnd( g, x[width-1], w1, w2, w3, y );
+		double y1 = y[0], y2 = y[1], y3 = y[2];
+		for (int n = width-1; n >= 0; n--){
+			double v = B*w[n] + a1*y1 + a2*y2 + a3*y3;
+			w[n] = v; 
+			y3 = y2; y2 = y1; y1 = v;
+		}
+	}
+}
+
+//columns [colStart, colEnd) filtered a row at a time (vectorizes over the columns)
+static void recursiveGaussColumns( int colStart, int colEnd, void *ctx )
+{
+	recursiveGauss_t *g = (recursiveGauss_t*)ctx;
+	const double B = (*g).B, a1 = (*g).a1, a2 = (*g).a2, a3 = (*g).a3;
+	int width  = (*g).width;
+	int height = (*g).height;
+	int n = colEnd-colStart;
+	double *t = (*g).tmp + colStart;
+	
+	std::vector<double> edge( t, t+n ); //first row (the state before it)
+	std::vector<double> last( t + (height-1)*width, t + (height-1)*width + n ); //last row before filtering
+	for (int r = 0; r < height; r++){
+		double *w = t + r*width;
+		const double *w1 = (r >= 1) ? w - width   : &edge[0];
+		const double *w2 = (r >= 2) ? w - 2*width : &edge[0];
+		const double *w3 = (r >= 3) ? w - 3*width : &edge[0];
+		for (int c = 0; c < n; c++){
+			w[c] = B*w[c] + a1*w1[c] + a2*w2[c] + a3*w3[c];
+		}
+	}
+	
+	std::vector<double> ends( 3*n ); //the backward states after the last row
+	for (int c = 0; c < n; c++){
+		double w[3], y[3];
+		for (int k = 0; k < 3; k++) { w[k] = (height-1-k >= 0) ? t[(height-1-k)*width + c] : edge[c]; }
+		recursiveGaussEnd( g, last[c], w[0], w[1], w[2], y );
+		for (int k = 0; k < 3; k++) { ends[k*n + c] = y[k]; }
+	}
+	for (int r = height-1; r >= 0; r--){
+		double *y = t + r*width;
+		const double *y1 = (r+1 < height) ? y + width   : &ends[(r+1-height)*n];
+		const double *y2 = (r+2 < height) ? y + 2*width : &ends[(r+2-height)*n];
+		const double *y3 = (r+3 < height) ? y + 3*width : &ends[(r+3-height)*n];
+		float *pOut = (*g).out + r*width + colStart;
+		for (int c = 0; c < n; c++){
+			double v = B*y[c] + a1*y1[c] + a2*y2[c] + a3*y3[c];
+			y[c] = v;
+			pOut[c] = (float)v;
 		}
-    } 
-	return 0;
- }
- 
- 
-/************************************************************************
- * Scale data from input to range [0 1] in output
- */
- int normaliseGrayToFloat( commonImage_t *input, commonImage_t *output ) 
- {
+	}
+}
+
+int gaussianRecursive_Float( commonImage_t *input, commonImage_t *output, float sigma )
+{
+	if (input == NULL || output == NULL || (*input).data == NULL || (*input).mode != Float1D || sigma < 0.5f) { return -2; }
+	
 	int width  = (*input).width;
 	int height = (*input).height;
 	int pixels = width*height;
-			
-	//double maxVal = -1;
-	float maxVal = std::numeric_limits<float>::min();
-	float minVal = std::numeric_limits<float>::max();
-	float range;
+	if (pixels <= 0) { return -2; }
 	
 	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
-		(*output).mode = Float1D;
-		(*output).width = width;
-		(*output).height = height;
 		(*output).data = realloc((*output).data, pixels*sizeof(float) );
 		if ((*output).data == NULL){
 			return -1;
 		}	
-	}
-		
-	float *pOut = (float*)(*output).data;	
+	}		
+	(*output).mode = Float1D;
+	(*output).width = width;
+	(*output).height = height;
 	
-	switch((*input).mode){
+	recursiveGauss_t g;
+	recursiveGaussCoefs( sigma, &g );
+	g.in  = (float*)(*input).data;
+	g.out = (float*)(*output).data;
+	g.width  = width;
+	g.height = height;
+	g.tmp = (double*)malloc( pixels*sizeof(double) );
+	if (g.tmp == NULL) { return -1; }
 	
-		case Gray8bpp:{
-			unsigned char *pIn = (unsigned char*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned char val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = (float)(1.0/(maxVal-minVal));
-			
-			pIn = (unsigned char*)(*input).data;
-			
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((float)(*pIn++)-minVal)*range); //floor to escape possible overflow?
-			}
+	parallelRows( height, recursiveGaussRows, &g );   //all of input read before output is written
+	parallelRows( width, recursiveGaussColumns, &g ); //column bands
+	
+	free( g.tmp );
+	return 0;
+}
 
-			break;
+/**
+ * Almost Gaussian filtering with a cascade of box filters
+ *  ref: "Fast Almost-Gaussian Filtering" Peter Kovesi, DICTA 2010
+ * The widths wl (first m passes) and wl+2 (rest) are chosen so that the variance of the 
+ * cascade is closest to sigma^2. Each box is a running sum in double (add the value 
+ * entering the window, subtract the one leaving it) over rows and then over columns.
+ * The lines are padded with the edge values by the sum of the box radii so that the 
+ * result is that of the cascade on the image extended with its edge values.
+ */
+typedef struct _boxCascade{
+	int passes;
+	int radius[8];   //box of each pass is 2*radius+1 wide
+	int pad;         //sum of radii
+	const float *in;
+	float *out;
+	int width;
+	int height;
+}boxCascade_t;
+
+static void boxCascadeWidths( double sigma, boxCascade_t *b )
+{
+	int n = (*b).passes;
+	double wIdeal = sqrt( 12*sigma*sigma/n + 1 );
+	int wl = (int)floor(wIdeal);
+	if (wl % 2 == 0) { wl--; }
+	int m = (int)floor( (12*sigma*sigma - n*wl*wl - 4*n*wl - 3*n)/(-4.0*wl - 4) + 0.5 );
+	(*b).pad = 0;
+	for (int k = 0; k < n; k++){
+		int w = (k < m) ? wl : wl+2;
+		(*b).radius[k] = (w-1)/2;
+		(*b).pad += (*b).radius[k];
+	}
+}
+
+//running box sum of 2r+1 values of src (n values, edge values repeated) to dst
+static void boxRun( const double *src, double *dst, int n, int r )
+{
+	double inv = 1.0/(2*r+1);
+	double acc = 0;
+	for (int k = -r; k <= r; k++){
+		acc += src[ std::min( std::max(k, 0), n-1 ) ];
+	}
+	int i = 0;
+	for (; i < n && (i < r || i+r+1 > n-1); i++){ //window over the ends
+		dst[i] = acc*inv;
+		acc += src[ std::min( i+r+1, n-1 ) ] - src[ std::max( i-r, 0 ) ];
+	}
+	for (; i+r+1 <= n-1; i++){
+		dst[i] = acc*inv;
+		acc += src[i+r+1] - src[i-r];
+	}
+	for (; i < n; i++){
+		dst[i] = acc*inv;
+		acc += src[n-1] - src[ std::max( i-r, 0 ) ];
+	}
+}
+
+static void boxCascadeRows( int rowStart, int rowEnd, void *ctx )
+{
+	boxCascade_t *b = (boxCascade_t*)ctx;
+	int width = (*b).width;
+	int pad = (*b).pad;
+	int n = width + 2*pad;
+	std::vector<double> buf( 2*n );
+	
+	for (int r = rowStart; r < rowEnd; r++){
+		double *src = &buf[0], *dst = &buf[n];
+		const float *pIn = (*b).in + r*width;
+		for (int c = 0; c < pad; c++){
+			src[c] = pIn[0];
+			src[pad+width+c] = pIn[width-1];
 		}
+		for (int c = 0; c < width; c++) { src[pad+c] = pIn[c]; }
 		
-		case Gray10bpp:
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:{
-			unsigned short *pIn = (unsigned short*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				unsigned short val = *pIn++;
-				if (val < minVal)		{ minVal = val; }
-				else if(val > maxVal) 	{ maxVal = val; }
-			}						
-			range = (float)(1.0/(maxVal-minVal));
-			
-			pIn = (unsigned short*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((float)(*pIn++)-minVal)*range);				
-			}
-						
-			break;
-		}
-		case Gray24bpp:
-		case Gray32bpp:{
-			unsigned int *pIn = (unsigned int*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				int val = *pIn++;
-				if (val < minVal)		{ minVal = (float)val; }
-				else if(val > maxVal) 	{ maxVal = (float)val; }
-			}						
-			range = (float)(1.0/(maxVal-minVal));
-			
-			pIn = (unsigned int*)(*input).data;
-						
-			count = pixels;
-			while(count-- > 0){
-				*pOut++ = (((float)(*pIn++)-minVal)*range);			
-			}						
-			break;
+		for (int k = 0; k < (*b).passes; k++){
+			boxRun( src, dst, n, (*b).radius[k] );
+			std::swap( src, dst );
 		}
+		float *pOut = (*b).out + r*width;
+		for (int c = 0; c < width; c++) { pOut[c] = (float)src[pad+c]; }
+	}
+}
 
-		case RGB8bpp:
-		case RGBA8bpp:		
-			return -2;
-			break;
-			
-		case Double1D:{
-			double *pIn = (double*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = (float)val; }
-				else if(val > maxVal) 	{ maxVal = (float)val; }
-			}
-			
-			range = (float)(1.0/(maxVal-minVal));
+//columns in chunks (the sums of a chunk of columns advance together row by row)
+static void boxCascadeColumns( int colStart, int colEnd, void *ctx )
+{
+	boxCascade_t *b = (boxCascade_t*)ctx;
+	const int chunk = 64;
+	int width  = (*b).width;
+	int height = (*b).height;
+	int pad = (*b).pad;
+	int n = height + 2*pad;
+	std::vector<double> buf( 2*chunk*n );
+	std::vector<double> acc( chunk );
 	
-			pIn = (double*)(*input).data;
-			count = pixels;
-			while(count-- > 0){		
-				*pOut++ = (((float)(*pIn++)-minVal)*range);				
-			}
-						
-			break;
+	for (int c0 = colStart; c0 < colEnd; c0 += chunk){
+		int nc = std::min( chunk, colEnd-c0 );
+		double *src = &buf[0], *dst = &buf[chunk*n];
+		for (int r = 0; r < n; r++){
+			int rr = std::min( std::max( r-pad, 0 ), height-1 );
+			const float *pRow = (*b).out + rr*width + c0;
+			for (int c = 0; c < nc; c++) { src[r*chunk + c] = pRow[c]; }
 		}
 		
-		case Float1D:{
-			float *pIn = (float*)(*input).data;
-			
-			int count = pixels;
-			while(count-- > 0){
-				double val = *pIn++;
-				if (val < minVal)		{ minVal = (float)val; }
-				else if(val > maxVal) 	{ maxVal = (float)val; }
+		for (int k = 0; k < (*b).passes; k++){
+			int rad = (*b).radius[k];
+			double inv = 1.0/(2*rad+1);
+			for (int c = 0; c < nc; c++) { acc[c] = 0; }
+			for (int j = -rad; j <= rad; j++){
+				const double *pS = src + std::min( std::max(j, 0), n-1 )*chunk;
+				for (int c = 0; c < nc; c++) { acc[c] += pS[c]; }
 			}
-			
-			range = (float)(1.0/(maxVal-minVal));
-	
-			pIn = (float*)(*input).data;
-			count = pixels;
-			while(count-- > 0){		
-				*pOut++ = (((float)(*pIn++)-minVal)*range);				
+			for (int r = 0; r < n; r++){
+				double *pD = dst + r*chunk;
+				const double *pAdd = src + std::min( r+rad+1, n-1 )*chunk;
+				const double *pSub = src + std::max( r-rad, 0 )*chunk;
+				for (int c = 0; c < nc; c++){
+					pD[c] = acc[c]*inv;
+					acc[c] += pAdd[c] - pSub[c];
+				}
 			}
-						
-			break;
+			std::swap( src, dst );
 		}
-    } 
-	return 0;
- }
- 
+		
+		for (int r = 0; r < height; r++){
+			float *pRow = (*b).out + r*width + c0;
+			for (int c = 0; c < nc; c++) { pRow[c] = (float)src[(r+pad)*chunk + c]; }
+		}
+	}
+}
 
-/********************************************************************************
- * Multiscale Retinex filtering (a sort of)
- *  (here expect image on range [0 1]
- */
-int multiscaleRetinexFilter( commonImage_t *input, commonImage_t *output )
+int gaussianBox_Float( commonImage_t *input, commonImage_t *output, float sigma, int passes )
 {
-	if (input==NULL) { return -2; }
-
-	int pixels = (*input).width*(*input).height;
-
+	if (input == NULL || output == NULL || (*input).data == NULL || (*input).mode != Float1D || 
+		sigma < 0.5f || passes < 1 || passes > 8) { return -2; }
+	
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
+	if (pixels <= 0) { return -2; }
+	
 	if ((*output).data == NULL || (*output).mode != Float1D || (*output).width*(*output).height < pixels ){
-		(*output).mode = Float1D;
-		(*output).width = (*input).width;
-		(*output).height = (*input).height;
 		(*output).data = realloc((*output).data, pixels*sizeof(float) );
 		if ((*output).data == NULL){
 			return -1;
 		}	
 	}		
+	(*output).mode = Float1D;
+	(*output).width = width;
+	(*output).height = height;
+	
+	boxCascade_t b;
+	b.passes = passes;
+	boxCascadeWidths( sigma, &b );
+	b.in  = (float*)(*input).data;
+	b.out = (float*)(*output).data;
+	b.width  = width;
+	b.height = height;
+	
+	parallelRows( height, boxCascadeRows, &b );   //rows read from input and written to output
+	parallelRows( width, boxCascadeColumns, &b ); //column bands of output in place
+	return 0;
+}
 
-	//buffers
-	commonImage_t imgF1(Float1D, (*input).width, (*input).height, NULL);	
-	imgF1.data = malloc(imgF1.width*imgF1.height * sizeof(float) );	
-	if (imgF1.data==NULL){ return -1; }
+/********************************************************************************
+ * Tiled 2D convolution engine
+ */
 
-	commonImage_t imgFlog(Float1D, (*input).width, (*input).height, NULL);	
-	imgFlog.data = malloc(imgFlog.width*imgFlog.height * sizeof(float) );	
-	if (imgFlog.data==NULL){ return -1; }	
+//the frame of border pixels set to value
+template <typename T>
+static void setBorders( T *data, int width, int height, int border, T value )
+{
+	for (int r = 0; r < height; r++){
+		T *pRow = data + r*width;
+		if (r < border || r >= height-border){
+			for (int c = 0; c < width; c++) { pRow[c] = value; }
+		}
+		else{
+			for (int c = 0; c < border && c < width; c++){
+				pRow[c] = value;
+				pRow[width-1-c] = value;
+			}
+		}
+	}
+}
 
-	int count = pixels;	
-	float *pIn1 = (float*)(*input).data ;
-	float *pOut = (float*)imgFlog.data;
-	while (count-- >0){		
-		*pOut++ = logf( 1 + *pIn1++ ) ;
+//index i outside [0 n) mapped inside as given by border, -1 for zero
+static int borderIndex( int i, int n, convBorder_e border )
+{
+	if (i >= 0 && i < n) { return i; }
+	if (border == CONV_BORDER_REPLICATE) { return i < 0 ? 0 : n-1; }
+	if (border == CONV_BORDER_MIRROR && n > 1){
+		int period = 2*n-2;
+		i = i % period;
+		if (i < 0) { i += period; }
+		return i < n ? i : period-i;
 	}
+	if (border == CONV_BORDER_MIRROR) { return 0; }
+	return -1;
+}
 
-	//These are from the Matlab implementation (now they do not seem that "intelligent" might really	
+template <typename T>
+struct convJob{
+	const T *in; T *out; const T *H;
+	int width; int height; int K;
+	convBorder_e border;
+	int x0, y0, x1, y1;                  //output area computed
+	int tileWidth; int tileHeight; int tilesX;
+	std::vector< std::vector<T> > *scratch;
+};
 
-#include "RetinexFilt9x9.h"
+static const int CONV_BLOCK = 16; //output pixels summed in registers at a time
 
-	//1st filter (TODO test how many really needed... - simpler might in similar manner...)
+/**
+ * One output row: acc = sum over kernel rows of (sum over kernel columns of H*in)
+ *  pIn   input at the top left of the kernel window of the first output pixel
+ *  rval  work row (n values)
+ */
+template <typename T>
+static void convolveRow( const T *pIn, int stride, const T *H, int K, T *pOut, T *rval, int n )
+{
+	for (int c = 0; c < n; c++) { pOut[c] = 0; }
 	
-	convolution2D_Float( input, &imgF1, *H1, 9 , true);	//true for borders to be set to zero (if not logf behaviour not defined)
-	count = pixels;										//obs same buffer used in following and thus once is ok...
-	pIn1 = (float*)imgF1.data;		//LP filtered data	
-	float *pIn2 = (float*)imgFlog.data;		//log of input	
-	pOut = (float*)(*output).data;		
-	float fact = 1.0f/3.0f;
-	while (count-- >0){				
-		*pOut++ =  (*pIn2++  - logf( 1 + *pIn1++ ) )*fact;
+	for (int rid = 0; rid < K; rid++){
+		const T *pH = H + rid*K;
+		const T *pRow = pIn + rid*stride;
+		int c = 0;
+		for (; c + CONV_BLOCK <= n; c += CONV_BLOCK){ //block of sums kept in registers over the kernel row
+			T r[CONV_BLOCK];
+			for (int j = 0; j < CONV_BLOCK; j++) { r[j] = 0; }
+			for (int cid = 0; cid < K; cid++){
+				T h = pH[cid];
+				const T *p = pRow + c + cid;
+				for (int j = 0; j < CONV_BLOCK; j++) { r[j] += h * p[j]; }
+			}
+			for (int j = 0; j < CONV_BLOCK; j++) { rval[c+j] = r[j]; }
+		}
+		for (; c < n; c++){
+			T r = 0;
+			for (int cid = 0; cid < K; cid++) { r += pH[cid] * pRow[c + cid]; }
+			rval[c] = r;
+		}
+		for (c = 0; c < n; c++) { pOut[c] += rval[c]; }
 	}
+}
 
-	convolution2D_Float( input, &imgF1, *H2, 9 );	
-	count = pixels;	
-	pIn1 = (float*)imgF1.data;
-	pIn2 = (float*)imgFlog.data;
-	pOut = (float*)(*output).data;	
-	while (count-- >0){		
-		*pOut++ += (*pIn2++  - logf( 1 + *pIn1++ ) )*fact;
+template <typename T>
+static void convTileTask( int worker, int id, void *ctx )
+{
+	convJob<T> &j = *(convJob<T>*)ctx;
+	int R = j.K>>1;
+	int tx0 = j.x0 + (id % j.tilesX)*j.tileWidth;
+	int ty0 = j.y0 + (id / j.tilesX)*j.tileHeight;
+	int tx1 = std::min( tx0 + j.tileWidth, j.x1 );
+	int ty1 = std::min( ty0 + j.tileHeight, j.y1 );
+	int tw = tx1-tx0;
+	
+	std::vector<T> &scratch = (*j.scratch)[worker];
+	T *rval = &scratch[0];
+	
+	const T *pIn;  //input at (tx0-R, ty0-R)
+	int stride;
+	if (tx0-R >= 0 && ty0-R >= 0 && tx1+R <= j.width && ty1+R <= j.height){
+		pIn = j.in + (ty0-R)*j.width + tx0-R;
+		stride = j.width;
 	}
-
-	convolution2D_Float( input, &imgF1, *H3, 9 );	
-	count = pixels;	
-	pIn1 = (float*)imgF1.data;
-	pIn2 = (float*)imgFlog.data;
-	pOut = (float*)(*output).data;	
-	while (count-- >0){		
-		*pOut++ +=  (*pIn2++  - logf( 1 + *pIn1++ ) )*fact;
+	else{ //copy of the tile with halo extended over the image borders
+		stride = tw + 2*R;
+		T *pTile = rval + j.tileWidth;
+		for (int r = 0; r < ty1-ty0+2*R; r++){
+			T *pRow = pTile + r*stride;
+			int yy = borderIndex( ty0-R+r, j.height, j.border );
+			for (int c = 0; c < stride; c++){
+				int xx = borderIndex( tx0-R+c, j.width, j.border );
+				pRow[c] = (yy < 0 || xx < 0) ? 0 : j.in[yy*j.width + xx];
+			}
+		}
+		pIn = pTile;
 	}
 	
-	setBordersTo( output, 4, 0);
-	
-	if (imgF1.data != NULL) { free(imgF1.data); }	
-	if (imgFlog.data != NULL) { free(imgFlog.data); }	
-	return 0;
+	for (int r = ty0; r < ty1; r++){
+		convolveRow( pIn + (r-ty0)*stride, stride, j.H, j.K, j.out + r*j.width + tx0, rval, tw );
+	}
 }
 
-/**
- * Do a convolution using 2D kernel having variable size with type Float
- *  The kernel size is expected to be odd. 
- *  The borders outside valid area are set to zero;
- */
-int convolution2D_Float( commonImage_t *input, commonImage_t *output, float *H, unsigned int Hsize, bool zeroBorders )
-{	
-	unsigned int imWidth = (*input).width;
-	unsigned int xs = Hsize>>1; 
-	unsigned int ys = Hsize>>1; 
-	unsigned int xe = imWidth-(xs*2);
-	unsigned int ye = (*input).height-ys;
-		
-	float **pin = (float**)malloc(sizeof(float*)*Hsize);	//Arrays for pointers
-	float **Hin = (float**)malloc(sizeof(float*)*Hsize);
-		
-	float **Hin0 = (float**)malloc(sizeof(float*)*Hsize); //init addresses precomputed
-	float **pin0 = (float**)malloc(sizeof(float*)*Hsize); //Arrays for pointers
-	
-	for (unsigned int rid = 0; rid < Hsize; rid++){
-		Hin0[rid] = (H+rid*Hsize);
-	}	
+template <typename T>
+static int convEngineRunT( convEngine_t *eng, std::vector< std::vector<T> > &scratch, commonImage_t *input, commonImage_t *output, 
+                           mode_e mode, const T *H, unsigned int Hsize, convBorder_e border )
+{
+	if (eng == NULL || input == NULL || output == NULL || (*input).data == NULL || (*input).mode != mode || H == NULL ||
+		Hsize == 0 || (Hsize & 1) == 0 || (*eng).tileWidth <= 0 || (*eng).tileHeight <= 0 || (*output).data == (*input).data) { return -2; }
 	
-	float *rval = (float *)malloc(sizeof(float)*Hsize);
-	float val;
+	int width  = (*input).width;
+	int height = (*input).height;
+	int pixels = width*height;
+	int R = Hsize>>1;
+	if (pixels <= 0) { return -2; }
+	if (border == CONV_BORDER_VALID && (width <= 2*R || height <= 2*R)) { return -3; }
 	
-	float *pOut;
-		
-	for (unsigned int r=ys; r<ye; r++){
-		
-		pOut = ((float*)(*output).data + (r * imWidth) + xs);
-		
-		for(unsigned int rid = 0; rid < Hsize; rid++){
-			pin0[rid] = ((float*)(*input).data + (r-ys+rid)*imWidth);
+	if ((*output).data == NULL || (*output).mode != mode || (*output).width*(*output).height < pixels ){
+		(*output).data = realloc((*output).data, pixels*sizeof(T) );
+		if ((*output).data == NULL){
+			return -1;
 		}	
+	}		
+	(*output).mode = mode;
+	(*output).width = width;
+	(*output).height = height;
 	
-		for (unsigned int c=0; c<xe; c++){
-		
-			//Set pointers to kernel row beginnings and to data block locations
-			//#pragma parfor 
-			for (unsigned int rid = 0; rid < Hsize; rid++){
-				//Hin[rid] = H+rid*Hsize;
-				//pin[rid] = ((float*)(*input).data + c + ((r-ys+rid)*imWidth));						
-				Hin[rid] = Hin0[rid];
-				pin[rid] = pin0[rid] + c ;				
-				rval[rid] = 0;
-				
-			}
-				
-			for (unsigned int cid = 0;cid < Hsize; cid++){				
-				//#pragma parfor 
-				for(unsigned int rid = 0; rid<Hsize; rid++){
-					rval[rid] += (*Hin[rid]++) * (*pin[rid]++);					
-				}
-			}
-			
-			val = 0;
-		
-			for (unsigned int rid = 0; rid < Hsize; rid++){
-				val += rval[rid];
-			}
-			*pOut++ = val;						
-			//*pOut++ = 1;
-		}
+	convJob<T> j;
+	j.in  = (T*)(*input).data;
+	j.out = (T*)(*output).data;
+	j.H = H;
+	j.width = width;
+	j.height = height;
+	j.K = Hsize;
+	j.border = border;
+	j.x0 = (border == CONV_BORDER_VALID) ? R : 0;
+	j.y0 = j.x0;
+	j.x1 = width - j.x0;
+	j.y1 = height - j.y0;
+	j.tileWidth  = std::min( (*eng).tileWidth, j.x1-j.x0 );
+	j.tileHeight = std::min( (*eng).tileHeight, j.y1-j.y0 );
+	j.tilesX = (j.x1-j.x0 + j.tileWidth-1) / j.tileWidth;
+	int tilesY = (j.y1-j.y0 + j.tileHeight-1) / j.tileHeight;
+	
+	//work row and the extended tile for each thread
+	size_t need = j.tileWidth + (size_t)(j.tileWidth + 2*R)*(j.tileHeight + 2*R);
+	if ((int)scratch.size() < getThreadCount()) { scratch.resize( getThreadCount() ); }
+	for (size_t w = 0; w < scratch.size(); w++){
+		if (scratch[w].size() < need) { scratch[w].resize( need ); }
 	}
-
-	if(zeroBorders){
-		setBordersTo( output, xs, 0);
-	}		
-		
-	free( rval );
-	free( pin  );
-	free( Hin  );
-	free( Hin0 );
-	free( pin0 );
+	j.scratch = &scratch;
 	
+	parallelWorkers( j.tilesX*tilesY, convTileTask<T>, &j );
 	return 0;
 }
 
-/*Double version of convolution*/
-int convolution2D_Double( commonImage_t *input, commonImage_t *output, double *H, unsigned int Hsize )
+int convEngineRun( convEngine_t *eng, commonImage_t *input, commonImage_t *output, const float *H, unsigned int Hsize, convBorder_e border )
+{
+	if (eng == NULL) { return -2; }
+	return convEngineRunT( eng, (*eng).scratchF, input, output, Float1D, H, Hsize, border );
+}
+
+int convEngineRun( convEngine_t *eng, commonImage_t *input, commonImage_t *output, const double *H, unsigned int Hsize, convBorder_e border )
+{
+	if (eng == NULL) { return -2; }
+	return convEngineRunT( eng, (*eng).scratchD, input, output, Double1D, H, Hsize, border );
+}
+
+void convEngineRelease( convEngine_t *eng )
+{
+	if (eng == NULL) { return; }
+	std::vector< std::vector<float> >().swap( (*eng).scratchF );
+	std::vector< std::vector<double> >().swap( (*eng).scratchD );
+}
+
+/*
+ * Engine of the convolution2D_ wrappers when the caller gives none: kept over calls so 
+ * that its scratch is allocated once. Used by one caller at a time, a call made while
+ * it is in use (from another thread) runs with a temporary engine.
+ */
+#ifndef _WIN32
+static convEngine_t    sharedConvEngine;
+static pthread_mutex_t sharedConvLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+template <typename T>
+static int convolution2D( commonImage_t *input, commonImage_t *output, const T *H, unsigned int Hsize, convEngine_t *eng )
+{
+	if (eng != NULL) { return convEngineRun( eng, input, output, H, Hsize, CONV_BORDER_VALID ); }
+#ifndef _WIN32
+	if (pthread_mutex_trylock( &sharedConvLock ) == 0){
+		int rval = convEngineRun( &sharedConvEngine, input, output, H, Hsize, CONV_BORDER_VALID );
+		pthread_mutex_unlock( &sharedConvLock );
+		return rval;
+	}
+#endif
+	convEngine_t tmp;
+	return convEngineRun( &tmp, input, output, H, Hsize, CONV_BORDER_VALID );
+}
+
+/**
+ * Do a convolution using 2D kernel having variable size with type Float
+ *  The kernel size is expected to be odd. 
+ *  The borders outside valid area are set to zero if zeroBorders;
+ */
+int convolution2D_Float( commonImage_t *input, commonImage_t *output, float *H, unsigned int Hsize, bool zeroBorders, convEngine_t *eng )
 {	
-	unsigned int imWidth = (*input).width;
-	unsigned int xs = Hsize>>1; 
-	unsigned int ys = Hsize>>1; 
-	unsigned int xe = imWidth-(xs*2);
-	unsigned int ye = (*input).height-ys;
-		
-	double **pin = (double**)malloc(sizeof(double*)*Hsize);	//Arrays for pointers
-	double **Hin = (double**)malloc(sizeof(double*)*Hsize);
-		
-	double **Hin0 = (double**)malloc(sizeof(double*)*Hsize); //init addresses precomputed
-	double **pin0 = (double**)malloc(sizeof(double*)*Hsize); //Arrays for pointers
-	
-	for (unsigned int rid = 0; rid < Hsize; rid++){
-		Hin0[rid] = (H+rid*Hsize);
-	}	
-	
-	double *rval = (double *)malloc(sizeof(double)*Hsize);
-	double val;
-	
-	double *pOut;
-		
-	for (unsigned int r=ys; r<ye; r++){
-		
-		pOut = ((double*)(*output).data + (r * imWidth) + xs);
-		
-		for(unsigned int rid = 0; rid < Hsize; rid++){
-			pin0[rid] = ((double*)(*input).data + (r-ys+rid)*imWidth);
-		}	
-	
-		for (unsigned int c=0; c<xe; c++){
-		
-			//Set pointers to kernel row beginnings and to data block locations
-			//#pragma parfor 
-			for (unsigned int rid = 0; rid < Hsize; rid++){
-				//Hin[rid] = H+rid*Hsize;
-				//pin[rid] = ((double*)(*input).data + c + ((r-ys+rid)*imWidth));						
-				Hin[rid] = Hin0[rid];
-				pin[rid] = pin0[rid] + c ;				
-				rval[rid] = 0;
-				
-			}
-				
-			for (unsigned int cid = 0;cid < Hsize; cid++){				
-				//#pragma parfor 
-				for(unsigned int rid = 0; rid<Hsize; rid++){
-					rval[rid] += (*Hin[rid]++) * (*pin[rid]++);					
-				}
-			}
-			
-			val = 0;
-		
-			//reduction
-			for (unsigned int rid = 0; rid < Hsize; rid++){
-				val += rval[rid];
-			}
-			*pOut++ = val;						
-			//*pOut++ = 1;
-		}
+	int rval = convolution2D( input, output, H, Hsize, eng );
+	if (rval == 0 && zeroBorders){
+		setBorders( (float*)(*output).data, (*output).width, (*output).height, Hsize>>1, 0.0f );
 	}
+	return rval;
+}
 
-	//set border pix to zero 
-	pOut = (double*)(*output).data;
-	memset( pOut, 0, sizeof(double)*imWidth*ys);
-	pOut = (double*)(*output).data + ye * imWidth;
-	memset( pOut, 0, sizeof(double)*imWidth*ys);	
-	
-	pOut = ((double*)(*output).data + (ys * imWidth) );
-	int stride = imWidth - Hsize + 1;
-	int stCount = (*input).height - Hsize ;	
-	for (int c = xs; c >0; c--) { *pOut++=0; }
-	pOut += stride;	
-	while (stCount-->0) {		
-		for (int c = xs+xs; c >0; c--) { *pOut++=0; }
-		pOut += stride;
+/*Double version of convolution*/
+int convolution2D_Double( commonImage_t *input, commonImage_t *output, double *H, unsigned int Hsize, convEngine_t *eng )
+{	
+	int rval = convolution2D( input, output, H, Hsize, eng );
+	if (rval == 0){
+		setBorders( (double*)(*output).data, (*output).width, (*output).height, Hsize>>1, 0.0 );
 	}
-	for (int c = xs; c >0; c--) { *pOut++=0; }
-	
-	free( rval );
-	free( pin  );
-	free( Hin  );
-	free( Hin0 );
-	free( pin0 );
-	
-	return 0;
+	return rval;
 }
 
 /******************************
@@ -1301,100 +2253,51 @@ int convolution2D_Double( commonImage_t *input, commonImage_t *output, double *H
 int setBordersTo( commonImage_t *input, unsigned int border, float value){
 	
 	if (input==NULL || (*input).data==NULL  || (*input).mode != Float1D ) {return -1;}
-		
-	unsigned int imWidth = (*input).width;
 	
-	float *pOut = (float*)(*input).data;
-	memset( pOut, 0, sizeof(float)*imWidth*border);		
-	pOut = (float*)(*input).data + ((*input).height-border)* imWidth;
-	memset( pOut, 0, sizeof(float)*imWidth*border);	
+	setBorders( (float*)(*input).data, (*input).width, (*input).height, border, value );
+	return 0;
+}
 
-	pOut = ((float*)(*input).data + (border * imWidth) );
-	int stride = imWidth - border - border;
-	int stCount = (*input).height - border - border - 1;		
-	
-	for (int c = border; c >0; c--) { *pOut++=0; }
-	pOut += stride;	
+///////////////////////////////////////////////////////////////////
+void imageStatsFromHistogram( const unsigned long *hist, int bins, imageStats_t *stats )
+{
+	imageStats_t hStats;
+	int minBin = -1, maxBin = -1;
 	
-	while (stCount-->0) {		
-		for (int c = border+border; c >0; c--) { *pOut++=0; }
-		pOut += stride;
-	}
-	for (int c = border; c >0; c--) { *pOut++=0; }
-		
-	/* //First version: 
-	unsigned int xe = (*input).width-(border*2);
-	unsigned int ye = (*input).height-border;	
-	for (unsigned int r=border; r<ye; r++){
-		pOut = ((double*)(*input).data + (r * imWidth) );	
-		double *pOut2 = ((double*)(*input).data + (r * imWidth) + xe);	
-		for (unsigned int cid = 0;cid <= border; cid++){		
-			*pOut++ = 0;
-			*pOut2++ = 0;
-		}		
+	for (int i = 0; i < bins; i++){
+		if (hist[i] == 0) { continue; }
+		if (minBin < 0) { minBin = i; }
+		maxBin = i;
+		hStats.sum   += (double)i*hist[i];
+		hStats.count += hist[i];
 	}
-	*/
-	
-	return 0;
-	
-}	
+	hStats.minVal = minBin;
+	hStats.maxVal = maxBin;
+	hStats.valid  = minBin >= 0;
+	*stats = hStats;
+}
 
 ///////////////////////////////////////////////////////////////////
-double totalSum( commonImage_t *input )
+double totalSum( commonImage_t *input, const imageStats_t *stats )
 {	
 	if (input == NULL || (*input).data == NULL){ return 0; }
 	
 	int count = (*input).width * (*input).height;
-	double sum = 0;	
 	
-	switch((*input).mode){
-				
-		case Gray8bpp:{
-			unsigned char *pIn = (unsigned char*)(*input).data;	
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}
-		case Gray10bpp:{
-		case Gray12bpp:
-		case Gray14bpp:
-		case Gray16bpp:
-			unsigned short *pIn = (unsigned short*)(*input).data;
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}
-		case Gray24bpp:{
-		case Gray32bpp:
-			unsigned int *pIn = (unsigned int*)(*input).data;	
-			while(count-->0) {sum += (double)*pIn++;}
-			break;		
-		}
-		case RGB8bpp:{
-			unsigned char *pIn = (unsigned char*)(*input).data;	
-			count *= 3;
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}	
-		case RGBA8bpp:{	
-			unsigned char *pIn = (unsigned char*)(*input).data;	
-			count *= 4;
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}
-		
-		case Double1D:{		
-			double *pIn = (double*)(*input).data;		
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}
-		case Float1D:{
-			float *pIn = (float*)(*input).data;		
-			while(count-->0) {sum += (double)*pIn++;}
-			break;
-		}
-
+	if (stats != NULL && (*stats).valid && (*stats).count == count){
+		return (*stats).sum;
+	}
+	
+	if ((*input).mode == RGB8bpp || (*input).mode == RGBA8bpp){
+		return sumKernel( (unsigned char*)(*input).data, count * ((*input).mode == RGB8bpp ? 3 : 4) );
 	}
 	
-	return sum;	
+	sumOp_t op;
+	op.count = count;
+	op.sum = 0;
+	dispatchGray( input, op );
+	
+	return op.sum;	
 }
 
 
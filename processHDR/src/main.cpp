@@ -21,10 +21,15 @@
 #include <cstdlib>
 #include <cstdio>
 #include <limits>
+#include <algorithm>
+#include <fstream>
 
 #include "imageProcessing.h"
 #include "fileIO.h"
 #include "clahe.h"
+#include "parallel.h"
+#include "simdKernels.h"
+#include "stackPipeline.h"
 
 //using namespace VisMe;
 
@@ -42,7 +47,27 @@ void printUsage(char* cmdStr)
 	std::cout << "-8b 		        save 8 bit output image data (def 32 bit)"<< std::endl;
 	std::cout << "-e <file>         If given load exposure times from given file (one per line as ascii)"<< std::endl;
 	std::cout << "-c                Apply CLAHE (contrast limited adaptive histogram equalization) on the hdr stack" << std::endl;
+	std::cout << "-cf               as -c but CLAHE directly on the float hdr stack (no normalisation to 12 bits)" << std::endl;
+	std::cout << "-cr <NX,NY>       number of CLAHE regions in x and y with -cf (def 16,16, any number from 2 to image size)" << std::endl;
 	std::cout << "-r                Compute retinex filter response (mean response out to std::out) (by default raw mean)" << std::endl;
+	std::cout << "-fl               fast vectorized log(1+x) in retinex (abs error < 5e-8, def logf)" << std::endl;
+	std::cout << "-f                also the visibility feature vector: retinex y-projection gradient (makeFeatureVector.m," << std::endl;
+	std::cout << "                  951 values for 960 rows) of the hdr data on [0 1], printed after the mean response" << std::endl;
+	std::cout << "                  (retinex options as with -r, in batch mode more columns in the result table)" << std::endl;
+	std::cout << "-rg               as -r but the Gaussians of the scales with full support (recursive filters)" << std::endl;
+	std::cout << "-rb               as -rg but Gaussians approximated with 3 box filters (faster, peak error < 6%)" << std::endl;
+	std::cout << "-rs <s1,s2,..>    retinex scales: Gaussian sigmas (def 15,80,250, max " << RETINEX_MAX_SCALES << " scales)" << std::endl;
+	std::cout << "-rw <w1,w2,..>    weights of the retinex scales (def equal 1/scales)" << std::endl;
+	std::cout << "-rk <N>           retinex kernel window size with -r (odd, def 9)" << std::endl;
+	std::cout << "-rd <N>           retinex kernel coefficients rounded to N decimals (def 6 as in the Matlab tables, 0 no rounding)" << std::endl;
+	std::cout << "-es <N>           use every N:th row in exposure check (def 1 all rows)"<< std::endl;
+	std::cout << "-j <N>            number of threads to use (def 1, 0 for all cores, in batch mode def all cores)"<< std::endl;
+	std::cout << "-x                exact hdr sum in 64 bit integers (integer exposure times and image data)" << std::endl;
+	std::cout << "-d <N>            number of threads decoding images ahead while stacking (def 1 with -j > 1 else 0, in batch mode 0)" << std::endl;
+	std::cout << "-b <root|file>    batch mode: process all stack folders in root (or listed in file one per line)" << std::endl;
+	std::cout << "                  and write result table (folder usableIdx meanResponse), stacks are run in parallel" << std::endl;
+	std::cout << "                  result images (-o out/result.tif) are named out/<folder>_result.tif" << std::endl;
+	std::cout << "-t <file>         batch mode result table file (def std::out, the messages then go to std::err)" << std::endl;
 	std::cout << "-v                be verbose if given"<< std::endl;
 	std::cout << std::endl;
 	std::cout << "example:> " <<cmdStr<<  " data/2014-08-15/ -o data/2014-08-15_result.tif -e data/expTimes.txt -r -v" << std::endl << std::endl;;
@@ -50,6 +75,454 @@ void printUsage(char* cmdStr)
 	exit(0);
 }
 
+/*********************************************************
+ * Image files of one stack read in one at a time
+ */
+typedef struct _stackFiles{
+	_stackFiles(std::string &_f, std::vector<std::string> &_n, bool _v): folder(_f), names(_n), verbose(_v){};
+
+	std::string &folder;             ///folder of the stack
+	std::vector<std::string> &names; ///sorted file names in folder
+	bool verbose;
+}stackFiles_t;
+
+/*********************************************************
+ * frameDecoder_t for image files (frame buffer is reused)
+ */
+int decodeStackFile( int id, commonImage_t *frame, void *ctx )
+{
+	stackFiles_t *files = (stackFiles_t*)ctx;
+	
+	std::string fullPath = (*files).folder + (*files).names[id];	
+	if((*files).verbose)  {std::cout << fullPath << " ";}
+	
+	return readTIFF( fullPath.c_str(), frame, (*files).verbose);
+}
+
+/*********************************************************
+ * The processing options (same for all stacks)
+ */
+typedef struct _stackOptions{
+	std::string filePrefix;
+	std::string fileSuffix;
+	bool verbose;
+	bool saveResultImage;
+	bool doRetinexFiltering;
+	bool featureVector;
+	retinexLowPass_e retinexLowPass;
+	const retinexKernels_t *retinexKernels; ///generated once at start up
+	bool fastLog;
+	bool doCLAHE;
+	bool claheFloat;
+	unsigned int claheRegionsX;
+	unsigned int claheRegionsY;
+	bool save8bitImage;
+	int exposureRowStep;
+	int decodeThreads;
+	bool exactSum;
+	float *expTimes;
+	unsigned int NexpTimes;
+}stackOptions_t;
+
+/*********************************************************
+ * The buffers used in processing one stack. In batch mode 
+ * these are kept over the stacks processed by one worker.
+ */
+typedef struct _stackBuffers{
+	std::vector<std::string> fileNames;
+	stackPipeline_t pipeline;
+	hdrAccumulator_t hdrSum;
+	exposureSelector_t selector;
+	claheWork_t claheWork;
+	commonImage_t hdrImage;
+	commonImage_t workCopy;
+	commonImage_t imageOut;
+}stackBuffers_t;
+
+void releaseStackBuffers( stackBuffers_t *buf )
+{
+	hdrAccumulatorRelease(&(*buf).hdrSum);
+	exposureSelectorRelease(&(*buf).selector);
+	claheWorkRelease(&(*buf).claheWork);
+	stackPipelineRelease(&(*buf).pipeline);
+	free((*buf).hdrImage.data);
+	free((*buf).workCopy.data);
+	free((*buf).imageOut.data);
+	(*buf).hdrImage.data = NULL;
+	(*buf).workCopy.data = NULL;
+	(*buf).imageOut.data = NULL;
+}
+
+//processStack errors
+const int STACK_NO_IMAGES   = -3;
+const int STACK_TOO_MANY    = -4;
+const int STACK_READ_ERROR  = -5;
+
+const char *stackErrorName( int err )
+{
+	switch (err){
+		case STACK_NO_IMAGES:  return "no images";
+		case STACK_TOO_MANY:   return "more images than exposure times";
+		case STACK_READ_ERROR: return "image read error";
+		default:               return "error";
+	}
+}
+
+/*********************************************************
+ * Process the image stack in one folder
+ * @param folderName the folder (ending with /)
+ * @param outName    the result image file (if saved)
+ * @param opt        processing options 
+ * @param buf        buffers used (reused if allocated)
+ * @param usableIdx  out: max usable image idx from the exposure check
+ * @param response   out: mean (retinex filtered) response
+ * @param feature    out: the retinex y-projection gradient with opt.featureVector (empty on error)
+ * @return error code, zero if success negative on error
+ */
+int processStack( std::string &folderName, const std::string &outName, stackOptions_t &opt, stackBuffers_t *buf, 
+				  int *usableIdx, double *response, std::vector<float> *feature )
+{
+  bool verbose = opt.verbose;
+  float *expTimes = opt.expTimes;
+
+  ///////////////////////////////////////////////////////////
+  // Find the files containing the image stack and read them
+  // (assumed increasing exposure time in sorted file names 
+  // (sorting is done here)
+  std::vector<std::string> &fileNames = (*buf).fileNames;
+  fileNames.clear();
+  FileIO::getFileNames(fileNames, folderName, opt.filePrefix, opt.fileSuffix);
+  
+  if (opt.NexpTimes < fileNames.size()){
+	std::cout << "More image files found than exposure times given. Terminating..." << std::endl;
+	return STACK_TOO_MANY;
+  }
+  
+  if (fileNames.size() < 1 ){
+	std::cout << "Error while loading image stack" << std::endl; 
+	return STACK_NO_IMAGES;
+  }
+  
+  ////////////////////////////////////////////////////////////////////////////////
+  //
+  // The actual image stack processing. The images are read in one at a time so 
+  // only single image and the hdr sum are in memory at once 
+  ////////////////////////////////////////////////////////////////////////////////
+  stackFiles_t stackFiles(folderName, fileNames, verbose);
+  stackPipeline_t &pipeline = (*buf).pipeline;
+
+  // The exposure check is done while stacking in increasing exposure order so the
+  // images after the first over exposed one are not read (decoded) at all
+  commonImage_t &hdrImage = (*buf).hdrImage;
+  hdrAccumulator_t &hdrSum = (*buf).hdrSum;
+  exposureSelector_t &selector = (*buf).selector;
+  
+  int idx = -1;
+  int lastId = fileNames.size()-1;
+  exposureSelectorOpen(&selector, fileNames.size(), 0.5, opt.exposureRowStep);
+  
+  if (verbose){ std::cout << "Reading in images for exposure check and stacking..." << std::endl;}
+  for (int pass = 0; pass < 2; pass++){
+	int stackedId = lastId;
+	//the images are decoded ahead (in decode threads) while the previous ones are stacked
+	stackPipelineStart(&pipeline, stackedId+1, opt.decodeThreads, opt.decodeThreads+2, decodeStackFile, &stackFiles);
+	for (int id = 0; id <= stackedId; id++){
+	  commonImage_t *frame = stackPipelineGet(&pipeline, id);
+	  if (frame == NULL ||
+		  (id == 0 && hdrAccumulatorOpen(&hdrSum, (*frame).width, (*frame).height, opt.exactSum) < 0) ||
+		  hdrAccumulatorAdd(&hdrSum, frame, expTimes[id]) < 0){
+		std::cout << "Error while reading image stack" << std::endl; 
+		stackPipelineStop(&pipeline);
+		return STACK_READ_ERROR;
+	  }
+	  if (pass == 0 && exposureSelectorAdd(&selector, id, frame) == 1){
+		stackedId = std::min(exposureSelectorResult(&selector), lastId);
+		stackPipelineLimit(&pipeline, stackedId);
+	  }
+	  stackPipelineRecycle(&pipeline, id);
+	}
+	stackPipelineStop(&pipeline);
+	
+	idx = exposureSelectorResult(&selector); //do not use first over exp  
+	if (verbose && pass == 0) {std::cout << "Found max usable image idx:" << idx << std::endl;}
+	lastId = (idx < 0 || idx >= (int)fileNames.size()) ? fileNames.size()-1 : idx;
+	
+	if (lastId == stackedId) { break; } 
+	//only with exposure check threshold over 0.5 the selection may be known after all images are read  
+	if (verbose){ std::cout << "Reading in images for stacking..." << std::endl;}
+  }
+  imageStats_t stats; //stats of the latest result (so that normalisation need not scan it)
+  hdrAccumulatorFinalize(&hdrSum, &hdrImage, &stats);
+
+  commonImage_t &workCopy = (*buf).workCopy;	
+  commonImage_t &imageOut = (*buf).imageOut;    
+  
+  if (opt.doCLAHE && opt.claheFloat){    
+	//CLAHE directly on the float hdr data (no 12 bit quantization)
+	if (verbose){
+		std::cout << "Applying Contrast Limited Adaptive Histogram Equalization (CLAHE) on float data" << std::endl;
+	}
+	if (!stats.valid){ //range of the float sum is not known
+		float minVal = *(float*)hdrImage.data; //minMaxF32 continues from the given values
+		float maxVal = minVal;
+		minMaxF32( (float*)hdrImage.data, hdrImage.width*hdrImage.height, &minVal, &maxVal );
+		stats.minVal = minVal;
+		stats.maxVal = maxVal;
+	}
+	int rval= ClaheT<float>(	(float*) hdrImage.data, 				//image data
+						hdrImage.width, hdrImage.height, 		//image size X,Y
+						(float)stats.minVal, (float)stats.maxVal,	//value range (both in and out)
+						opt.claheRegionsX, opt.claheRegionsY,	//number of regions in x,y (min 2, any size)
+						256,									//Number of greybins for histogram ("dynamic range") 
+						10.000,									//Normalized cliplimit, A clip limit
+						&stats,									//stats of result
+						&(*buf).claheWork);						//buffers kept over stacks
+	if (rval < 0) {
+		std::cout << "WARNING CLAHE error  " << rval << std::endl;			
+	}	
+	normaliseGrayToFloat(&hdrImage, &hdrImage, &stats, &stats);
+  }
+  else if (opt.doCLAHE){    
+
+	
+//	normaliseGrayTo8bit( &hdrImage, &workCopy);		
+	normaliseGrayTo12bit( &hdrImage, &workCopy, &stats);	//OBS is this the best way? 
+													//alt - do clahe for each image prior stacking?
+	
+	if (verbose){
+		std::cout << "Applying Contrast Limited Adaptive Histogram Equalization (CLAHE)" << std::endl;
+	}
+	
+	//TODO what are the "BEST" parameters for CLAHE? 
+	//this is ok for decent viewing
+	unsigned long claheHist[uiNR_OF_GREY] = {0};
+	int rval= ClaheParallel((kz_pixel_t*) workCopy.data, 			//image data
+						workCopy.width, workCopy.height, 		//image size X,Y
+						0, 4095, 								//value range (both in and out)
+						16,16,									//number of regions in x,y (min 2, max uiMAX_REG_X) OBS x%==0!
+						256,									//Number of greybins for histogram ("dynamic range") 
+						10.000,									//Normalized cliplimit, A clip limit
+						claheHist);								//histogram of result (for stats)
+						
+	/* //These params give "nice" results with retinex for ligting normalization ie use -r -c
+	//obs either Nbins down and cliplimit up or bins up and limit down...
+	int rval= Clahe(	(kz_pixel_t*) workCopy.data, 			//image data
+						workCopy.width, workCopy.height, 		//image size X,Y
+						0, 4095, 								//value range (both in and out)
+						32,32,									//number of regions in x,y (min 2, max uiMAX_REG_X)
+						32760,									//Number of greybins for histogram ("dynamic range") 
+						0.01);									//Normalized cliplimit, A clip limit smaller than 1 
+	*/
+	
+	if (rval < 0) {
+		std::cout << "WARNING CLAHE error  " << rval << std::endl;			
+	}	
+	imageStatsFromHistogram( claheHist, uiNR_OF_GREY, &stats );
+	normaliseGrayToFloat(&workCopy, &hdrImage, &stats, &stats);
+  }  
+  
+  if (opt.featureVector) {
+	//as makeFeatureVector.m for the hdr image normalised to [0 1] (normaliseToDouble.m), only 
+	//the row sums of the retinex response are kept
+	if (verbose){
+		std::cout << "Computing retinex y-projection gradient feature vector" << std::endl;
+	}
+	normaliseGrayToFloat(&hdrImage, &workCopy, &stats);
+	if (retinexProjectionGradient( &workCopy, *feature, opt.fastLog, opt.retinexLowPass, opt.retinexKernels ) < 0){
+		std::cout << "WARNING feature vector could not be computed" << std::endl;
+		(*feature).clear();
+	}
+  }
+  
+  if (opt.doRetinexFiltering) {
+	//  normaliseGrayToFloat( &hdrImage, &workCopy );   //TODO check normalisation to double effect
+	//  multiscaleRetinexFilter( &workCopy, &hdrImage); 
+	if (verbose){
+		std::cout << "Applying Retinex filter" << std::endl;
+	}
+	
+	multiscaleRetinexFilter( &hdrImage, &workCopy, &stats, opt.fastLog, opt.retinexLowPass, opt.retinexKernels ); 	
+	normaliseGrayToFloat(&workCopy, &workCopy, &stats, &stats);
+  }
+  else{
+	normaliseGrayToFloat(&hdrImage, &workCopy, &stats, &stats); 
+  }
+
+  *usableIdx = idx;
+  *response = totalSum( &workCopy, &stats ) / (double)(workCopy.width*workCopy.height);	
+	
+  if (opt.saveResultImage) {  
+	if (opt.save8bitImage){
+		normaliseGrayTo8bit(&workCopy, &imageOut, &stats);  //TIFF 32bit int (retain most information) 
+	}	
+	else{
+		normaliseGrayTo32bit(&workCopy, &imageOut, &stats);  //TIFF 32bit int (retain most information) 
+	}
+	saveTIFF( outName.c_str(), &imageOut, COMPRESSION_ZIP);  
+  }
+  return 0;
+}
+
+/*********************************************************
+ * Batch mode: the stacks are divided to workers (one stack 
+ * at a time per worker) and each worker reuses its buffers
+ */
+typedef struct _batchJob{
+	std::vector<std::string> folders;   ///stack folders (ending with /)
+	std::vector<std::string> outNames;  ///result image for each folder
+	std::vector<int> status;            ///processStack return values
+	std::vector<int> usableIdx;
+	std::vector<double> response;
+	std::vector< std::vector<float> > features;
+	std::vector<stackBuffers_t> buffers; ///one set per worker
+	stackOptions_t *opt;
+}batchJob_t;
+
+static void processBatchStack( int worker, int id, void *ctx )
+{
+	batchJob_t *job = (batchJob_t*)ctx;
+	
+	(*job).status[id] = processStack( (*job).folders[id], (*job).outNames[id], *(*job).opt, 
+									  &(*job).buffers[worker], &(*job).usableIdx[id], &(*job).response[id], &(*job).features[id] );
+}
+
+/*********************************************************
+ * Process all stacks under root folder (or listed in a file one
+ * folder per line) and write the result table (folder, usable 
+ * idx, mean response) to file tableName or if not given to stdTable
+ * @return error code, zero if success negative on error
+ */
+int processBatch( std::string &batchSource, std::string &tableName, std::ostream &stdTable, std::string &outName, stackOptions_t &opt )
+{
+	batchJob_t job;
+	job.opt = &opt;
+	
+	if ( FileIO::dirExist( (char*)batchSource.c_str() ) ){
+		std::vector<std::string> dirs;
+		FileIO::getDirNames( dirs, batchSource );
+		if (batchSource[batchSource.length()-1] != '/') { batchSource += "/"; }
+		for (unsigned int i=0; i < dirs.size(); i++){
+			job.folders.push_back( batchSource + dirs[i] + "/" );
+		}
+	}
+	else{
+		std::ifstream listFile( batchSource.c_str() );
+		std::string line;
+		while ( std::getline( listFile, line ) ){
+			line.erase( line.find_last_not_of( " \t\r" ) + 1 );
+			if (line.length() == 0) { continue; }
+			if (line[line.length()-1] != '/') { line += "/"; }
+			job.folders.push_back( line );
+		}
+	}
+	
+	//result images named after the stack folder eg. out/result.tif -> out/<folder>_result.tif
+	size_t split = outName.find_last_of( '/' );
+	std::string outDir  = (split == std::string::npos) ? "" : outName.substr( 0, split+1 );
+	std::string outBase = (split == std::string::npos) ? outName : outName.substr( split+1 );
+	for (unsigned int i=0; i < job.folders.size(); i++){
+		std::string folder = job.folders[i].substr( 0, job.folders[i].length()-1 );
+		job.outNames.push_back( outDir + folder.substr( folder.find_last_of( '/' ) + 1 ) + "_" + outBase );
+	}
+	
+	int nStacks = job.folders.size();
+	job.status.assign( nStacks, 0 );
+	job.usableIdx.assign( nStacks, -1 );
+	job.response.assign( nStacks, 0 );
+	job.features.resize( nStacks );
+	job.buffers.resize( getThreadCount() );
+	
+	if (opt.verbose){ std::cout << nStacks << " stacks in '" << batchSource << "'" << std::endl;}
+	
+	parallelWorkers( nStacks, processBatchStack, &job );
+	
+	for (int i=0; i < nStacks; i++){
+		if (job.status[i] < 0){
+			std::cout << "Stack '" << job.folders[i] << "' not processed: " << stackErrorName( job.status[i] ) << std::endl;
+		}
+	}
+	
+	for (unsigned int i=0; i < job.buffers.size(); i++){
+		releaseStackBuffers( &job.buffers[i] );
+	}
+	
+	std::ofstream tableFile;
+	if (tableName.length() > 0){
+		tableFile.open( tableName.c_str() );
+		if (!tableFile.is_open()){
+			std::cout << "Could not open result table '" << tableName << "'" << std::endl;
+			return -1;
+		}
+	}
+	std::ostream &table = tableName.length() > 0 ? tableFile : stdTable;
+	
+	//with feature vectors a column for each value (f1 f2 ...)
+	size_t nFeatures = 0;
+	for (int i=0; i < nStacks; i++){
+		nFeatures = std::max( nFeatures, job.features[i].size() );
+	}
+	table << "folder\tusableIdx\tmeanResponse";
+	for (size_t k=0; k < nFeatures; k++){
+		table << "\tf" << k+1;
+	}
+	table << std::endl;
+	for (int i=0; i < nStacks; i++){
+		table << job.folders[i] << "\t";
+		if (job.status[i] < 0){
+			table << "NA\tNA";  //stack could not be processed
+		}
+		else{
+			table << job.usableIdx[i] << "\t" << job.response[i];
+		}
+		for (size_t k=0; k < nFeatures; k++){
+			if (k < job.features[i].size()) { table << "\t" << job.features[i][k]; }
+			else                            { table << "\tNA"; }
+		}
+		table << std::endl;
+	}
+	return 0;
+}
+
+/*********************************************************
+ * Comma separated list of whole numbers in [minVal maxVal] (eg. 16,12)
+ * @return number of values, -1 if not a list of at most maxCount such numbers
+ */
+int parseIntList( const char *str, unsigned int *values, int maxCount, long minVal, long maxVal )
+{
+	int count = 0;
+	const char *p = str;
+	while (*p != '\0'){
+		char *end;
+		long val = strtol( p, &end, 10 );
+		if (end == p || count == maxCount || (*end != ',' && *end != '\0') || val < minVal || val > maxVal){
+			return -1;
+		}
+		values[count++] = (unsigned int)val;
+		p = (*end == ',') ? end+1 : end;
+	}
+	return count;
+}
+
+/*********************************************************
+ * Comma separated list of numbers (eg. 15,80,250)
+ * @return number of values, -1 if not a list of at most maxCount numbers
+ */
+int parseFloatList( const char *str, float *values, int maxCount )
+{
+	int count = 0;
+	const char *p = str;
+	while (*p != '\0'){
+		char *end;
+		double val = strtod( p, &end );
+		if (end == p || count == maxCount || (*end != ',' && *end != '\0')){
+			return -1;
+		}
+		values[count++] = (float)val;
+		p = (*end == ',') ? end+1 : end;
+	}
+	return count;
+}
+
 /*********************************************************
  * The program main entry point
  */
@@ -65,8 +538,22 @@ int main(int argc, char** argv)
   bool verbose = false;
   bool saveResultImage = false;
   bool doRetinexFiltering = false;
+  bool featureVector = false;
+  retinexLowPass_e retinexLowPass = RETINEX_LP_KERNEL;
+  retinexParams_t retinexParams;    //def as in the Matlab implementation
+  int retinexWeights = 0;           //number of weights given (def equal)
+  bool fastLog = false;
   bool doCLAHE = false;
+  bool claheFloat = false;
+  unsigned int claheRegions[2] = {16, 16};
+  bool claheRegionsGiven = false;
   bool save8bitImage = false;
+  int exposureRowStep = 1;
+  int decodeThreads = -1;           //def 1 if more than one thread (0 in batch mode)
+  bool threadsGiven = false;
+  bool exactSum = false;
+  std::string batchSource = "";     //root folder or folder list file for batch mode
+  std::string tableName = "";       //batch mode result table (def std::cout)
   
   float expTimesDef[] = { 25,50,100,200,400,800,1600,3200,6400,12800,25600,
 						   51200,102400,204800,409600,819200,1638400,3276800,		
@@ -115,9 +602,73 @@ int main(int argc, char** argv)
 	  else if (argStr == "-r"){
 		doRetinexFiltering = true;
 	  }
+	  else if (argStr == "-rg"){
+		doRetinexFiltering = true;
+		retinexLowPass = RETINEX_LP_RECURSIVE;
+	  }
+	  else if (argStr == "-rb"){
+		doRetinexFiltering = true;
+		retinexLowPass = RETINEX_LP_BOX;
+	  }
+	  else if (argStr == "-rs" && i <argc-1){
+		retinexParams.scales = parseFloatList( argv[++i], retinexParams.sigma, RETINEX_MAX_SCALES );
+		if (retinexParams.scales < 1){
+			std::cout << "Retinex scales '" << argv[i] << "' are not a list of 1.." << RETINEX_MAX_SCALES << " sigmas" << std::endl;
+			exit(0);
+		}
+	  }
+	  else if (argStr == "-rw" && i <argc-1){
+		retinexWeights = parseFloatList( argv[++i], retinexParams.weight, RETINEX_MAX_SCALES );
+	  }
+	  else if (argStr == "-rk" && i <argc-1){
+		retinexParams.window = atoi(argv[++i]);
+	  }
+	  else if (argStr == "-rd" && i <argc-1){
+		retinexParams.decimals = atoi(argv[++i]);
+	  }
+	  else if (argStr == "-fl"){
+		fastLog = true;
+	  }
+	  else if (argStr == "-f"){
+		featureVector = true;
+	  }
 	  else if (argStr == "-c"){
 		doCLAHE = true;
+	  }
+	  else if (argStr == "-cr" && i <argc-1){
+		if (parseIntList( argv[++i], claheRegions, 2, 2, 65535 ) != 2){
+			std::cout << "CLAHE regions '" << argv[i] << "' are not NX,NY (whole numbers 2..65535)" << std::endl;
+			exit(0);
+		}
+		claheRegionsGiven = true;
+	  }
+	  else if (argStr == "-cf"){
+		doCLAHE = true;
+		claheFloat = true;
 	  }	  
+	  else if (argStr == "-es" && i <argc-1){
+		exposureRowStep = atoi(argv[++i]);
+	  }
+	  else if (argStr == "-j" && i <argc-1){
+		setThreadCount( atoi(argv[++i]) );
+		threadsGiven = true;
+	  }
+	  else if (argStr == "-x"){
+		exactSum = true;
+	  }
+	  else if (argStr == "-d" && i <argc-1){
+		decodeThreads = atoi(argv[++i]);
+	  }
+	  else if (argStr == "-b" && i <argc-1){
+		batchSource = argv[++i];
+		if ( !FileIO::dirExist( (char*)batchSource.c_str() ) && !FileIO::fileExist( (char*)batchSource.c_str() ) ){
+			std::cout << "Batch folder or folder list '" << batchSource << "' was not found" << std::endl;
+			exit(0);
+		}
+	  }
+	  else if (argStr == "-t" && i <argc-1){
+		tableName = argv[++i];
+	  }
 	  
 	  else if (argStr == "-e"){
 	  
@@ -146,6 +697,10 @@ int main(int argc, char** argv)
 	  }  
     }
   } //end for : command line parameters
+  
+  //batch mode with the result table on std::out: all messages (also those of readTIFF) go to std::cerr
+  std::streambuf *stdOut = std::cout.rdbuf();
+  if (batchSource.length() > 0 && tableName.length() == 0) { std::cout.rdbuf( std::cerr.rdbuf() ); }
 
   ////////////////////////////////////////////////////////////////
   //If separate text file containing exposure times read them in
@@ -182,132 +737,113 @@ int main(int argc, char** argv)
 	std::cout << std::endl;		
   }
 
-  ///////////////////////////////////////////////////////////
-  // Find the files containing the image stack and read them
-  // (assumed increasing exposure time in sorted file names 
-  // (sorting is done here)
-  std::vector<std::string>  fileNames;
-  FileIO::getFileNames(fileNames, folderName, filePrefix, fileSuffix);
-  
-  if (NexpTimes < fileNames.size()){
-	std::cout << "More image files found than exposure times given. Terminating..." << std::endl;
+  if (exactSum){
+	for (unsigned int id=0; id < NexpTimes; id++){
+		if (!isExactExposureTime( expTimes[id] )){
+			std::cout << "Exact sum (-x) needs integer exposure times (0.." << 0xffffffffu << "), got " << expTimes[id] << std::endl;
+			exit(0);
+		}
+	}
+  }
+
+  if (claheRegionsGiven && !claheFloat){
+	std::cout << "CLAHE regions (-cr) are used only with -cf (-c uses 16,16)" << std::endl;
 	exit(0);
   }
   
-  std::vector<commonImage_t> imageStack;  
-
-  if (verbose){ std::cout << "Reading in images..." << std::endl;}
-  std::vector<std::string>::iterator fName = fileNames.begin();
-  while ( fName != fileNames.end() ){  	
-	commonImage_t imIn;
-	std::string fullPath = folderName+(*fName++);	
-	if(verbose)  {std::cout << fullPath << " ";}
-	readTIFF( fullPath.c_str(), &imIn, verbose);
-	imageStack.push_back(imIn);	
+  //retinex kernels made once for all the stacks
+  if (retinexWeights == 0){
+	for (int s = 0; s < retinexParams.scales; s++) { retinexParams.weight[s] = 1.0f/retinexParams.scales; }
   }
-  
-  if (imageStack.size() < 1 ){
-	std::cout << "Error while loading image stack" << std::endl; 
-	exit(-3);
+  else if (retinexWeights != retinexParams.scales){
+	std::cout << "Retinex weights (-rw) must be given for each of the " << retinexParams.scales << " scales" << std::endl;
+	exit(0);
   }
+  retinexKernels_t retinexKernels;
+  if (doRetinexFiltering || featureVector){
+	if (retinexKernelsOpen( &retinexKernels, &retinexParams ) < 0){
+		std::cout << "Invalid retinex parameters (sigmas > 0, odd kernel window)" << std::endl;
+		exit(0);
+	}
+	if (verbose){
+		std::cout << "Retinex scales (sigma:weight):";
+		for (int s = 0; s < retinexParams.scales; s++){
+			std::cout << " " << retinexParams.sigma[s] << ":" << retinexParams.weight[s];
+		}
+		if (retinexLowPass == RETINEX_LP_KERNEL){
+			std::cout << " window " << retinexParams.window << (retinexKernels.separable ? " (separable)" : " (rounding breaks separability, 2D kernels, see -rd)");
+		}
+		std::cout << std::endl;
+	}
+  }
+
+  stackOptions_t opt;
+  opt.filePrefix = filePrefix;
+  opt.fileSuffix = fileSuffix;
+  opt.verbose = verbose;
+  opt.saveResultImage = saveResultImage;
+  opt.doRetinexFiltering = doRetinexFiltering;
+  opt.featureVector = featureVector;
+  opt.retinexLowPass = retinexLowPass;
+  opt.retinexKernels = &retinexKernels;
+  opt.fastLog = fastLog;
+  opt.doCLAHE = doCLAHE;
+  opt.claheFloat = claheFloat;
+  opt.claheRegionsX = claheRegions[0];
+  opt.claheRegionsY = claheRegions[1];
+  opt.save8bitImage = save8bitImage;
+  opt.exposureRowStep = exposureRowStep;
+  opt.exactSum = exactSum;
+  opt.decodeThreads = decodeThreads >= 0 ? decodeThreads : (batchSource.length() > 0 || getThreadCount() < 2 ? 0 : 1);
+  opt.expTimes = expTimes;
+  opt.NexpTimes = NexpTimes;
   
+  if (batchSource.length() > 0){  
+	if (!threadsGiven) { setThreadCount(0); } //all cores
+	std::ostream stdTable( stdOut );
+	if (verbose){ std::cout << "Threads: " << getThreadCount() << " SIMD kernels: " << simdLevelName(getSimdLevel()) << std::endl;}
+	
+	int rval = processBatch( batchSource, tableName, stdTable, outName, opt );
+	std::cout.rdbuf( stdOut );
+	retinexKernelsRelease(&retinexKernels);
+	if (expTimes != expTimesDef)
+		free(expTimes);
+	return rval;
+  }
   
-  ////////////////////////////////////////////////////////////////////////////////
-  //
-  // The actual image stack processing  (there is room to optimize so that 
-  //                                     single image is read for stack at a time...
-  ////////////////////////////////////////////////////////////////////////////////
-    
-  int idx = findLastOkExposureImage(imageStack, 0.5); //do not use first over exp  
-  if (verbose) {std::cout << "Found max usable image idx:" << idx << std::endl;}
- 
-  
-  commonImage_t hdrImage;
-  
-  //sumGrayStack( imageStack, &resultImage); //very dummy version   
-  sumGrayStackWExpTimes(imageStack, expTimes, &hdrImage, idx);   
-  releaseStackData( imageStack );
-  imageStack.clear();
-
-  commonImage_t workCopy;	
-  commonImage_t imageOut;    
+  if (verbose){ std::cout << "Threads: " << getThreadCount() << " SIMD kernels: " << simdLevelName(getSimdLevel()) << std::endl;}
   
+  stackBuffers_t buffers;
+  int usableIdx;
   double resSum;
+  std::vector<float> feature;
   
-  if (doCLAHE){    
-
-	
-//	normaliseGrayTo8bit( &hdrImage, &workCopy);		
-	normaliseGrayTo12bit( &hdrImage, &workCopy);	//OBS is this the best way? 
-													//alt - do clahe for each image prior stacking?
-	
-	if (verbose){
-		std::cout << "Applying Contrast Limited Adaptive Histogram Equalization (CLAHE)" << std::endl;
-	}
-	
-	//TODO what are the "BEST" parameters for CLAHE? 
-	//this is ok for decent viewing
-	int rval= Clahe(	(kz_pixel_t*) workCopy.data, 			//image data
-						workCopy.width, workCopy.height, 		//image size X,Y
-						0, 4095, 								//value range (both in and out)
-						16,16,									//number of regions in x,y (min 2, max uiMAX_REG_X) OBS x%==0!
-						256,									//Number of greybins for histogram ("dynamic range") 
-						10.000);								//Normalized cliplimit, A clip limit
-						
-	/* //These params give "nice" results with retinex for ligting normalization ie use -r -c
-	//obs either Nbins down and cliplimit up or bins up and limit down...
-	int rval= Clahe(	(kz_pixel_t*) workCopy.data, 			//image data
-						workCopy.width, workCopy.height, 		//image size X,Y
-						0, 4095, 								//value range (both in and out)
-						32,32,									//number of regions in x,y (min 2, max uiMAX_REG_X)
-						32760,									//Number of greybins for histogram ("dynamic range") 
-						0.01);									//Normalized cliplimit, A clip limit smaller than 1 
-	*/
-	
-	if (rval < 0) {
-		std::cout << "WARNING CLAHE error  " << rval << std::endl;			
-	}	
-	normaliseGrayToFloat(&workCopy, &hdrImage);
-  }  
+  int rval = processStack( folderName, outName, opt, &buffers, &usableIdx, &resSum, &feature );
+  if (rval == STACK_TOO_MANY){
+	exit(0);
+  }
+  else if (rval < 0){
+	exit(rval);
+  }
   
-  if (doRetinexFiltering) {
-	//  normaliseGrayToFloat( &hdrImage, &workCopy );   //TODO check normalisation to double effect
-	//  multiscaleRetinexFilter( &workCopy, &hdrImage); 
-	if (verbose){
-		std::cout << "Applying Retinex filter" << std::endl;
-	}
-	
-	multiscaleRetinexFilter( &hdrImage, &workCopy ); 	
-	normaliseGrayToFloat(&workCopy, &workCopy);
-	
-	if (verbose) {
-	std::cout << "Retinex filtered mean response: " ;
-	}
+  if (verbose) {
+	std::cout << (doRetinexFiltering ? "Retinex filtered mean response: " : "Mean raw response: ");
   }
-  else{
-	normaliseGrayToFloat(&hdrImage, &workCopy); 
+  std::cout << resSum << std::endl;
+  
+  if (featureVector){
 	if (verbose) {
-	std::cout << "Mean raw response: " ;
+		std::cout << "Retinex y-projection gradient feature vector (" << feature.size() << " values):" << std::endl;
 	}
-  }
-
-  resSum = totalSum( &workCopy ) / (double)(workCopy.width*workCopy.height);	
-  std::cout << resSum << std::endl;
-	
-  if (saveResultImage) {  
-	if (save8bitImage){
-		normaliseGrayTo8bit(&workCopy, &imageOut);  //TIFF 32bit int (retain most information) 
-	}	
-	else{
-		normaliseGrayTo32bit(&workCopy, &imageOut);  //TIFF 32bit int (retain most information) 
+	for (size_t k=0; k < feature.size(); k++){
+		std::cout << (k > 0 ? " " : "") << feature[k];
 	}
-	saveTIFF( outName.c_str(), &imageOut, COMPRESSION_ZIP);  
+	std::cout << std::endl;
   }
+	
   //Clean UP  
-  fileNames.clear();
-  free(imageOut.data);
-  free(workCopy.data);
-  free(hdrImage.data);
+  releaseStackBuffers(&buffers);
+  retinexKernelsRelease(&retinexKernels);
   
   if (expTimes != expTimesDef)
 	free(expTimes);
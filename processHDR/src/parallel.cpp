@@ -0,0 +1,234 @@
+/*****************************************************************
+ * parallel.cpp
+ *
+ * implement parallel.h
+ *
+ * Sami Varjo 2014
+ *****************************************************************/
+
+#include "parallel.h"
+
+#include <cstdlib>
+#include <stdint.h>
+
+#ifndef _WIN32
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+static int threadCount = 1;
+
+#ifndef _WIN32
+//The pool state (all protected by poolLock)
+static pthread_mutex_t poolLock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  poolStart    = PTHREAD_COND_INITIALIZER;  //new job posted
+static pthread_cond_t  poolFinished = PTHREAD_COND_INITIALIZER;  //all tasks of job done
+static int  poolWorkers = 0;       //number of started worker threads
+static bool poolBusy = false;      //a job is running
+static unsigned int poolJob = 0;   //job counter
+
+static parallelTask_t poolTask = NULL;
+static void *poolCtx = NULL;
+static int poolTasks = 0;          //number of tasks in job
+static int poolNext  = 0;          //next task id to hand out
+static int poolDone  = 0;          //number of finished tasks
+
+/*
+ * Run tasks of the current job until none left (called and returns with poolLock held)
+ */
+static void runPoolTasks()
+{
+	while (poolNext < poolTasks){
+		int id = poolNext++;
+		parallelTask_t task = poolTask;
+		void *ctx = poolCtx;
+
+		pthread_mutex_unlock(&poolLock);
+		task( id, ctx );
+		pthread_mutex_lock(&poolLock);
+
+		if (++poolDone == poolTasks){
+			pthread_cond_broadcast(&poolFinished);
+		}
+	}
+}
+
+/*
+ * Worker thread main loop
+ */
+static void* poolWorker( void *arg )
+{
+	int workerId = (int)(long)arg;
+	unsigned int seenJob = 0;
+
+	pthread_mutex_lock(&poolLock);
+	while (true){
+		//extra workers (thread count lowered) stay idle
+		while (poolJob == seenJob || workerId >= threadCount-1){
+			pthread_cond_wait(&poolStart, &poolLock);
+		}
+		seenJob = poolJob;
+		runPoolTasks();
+	}
+	return NULL;
+}
+#endif
+
+/*****************************************************************
+ * Thread count
+ */
+void setThreadCount( int n )
+{
+	if (n <= 0){
+#ifdef _WIN32
+		n = 1;
+#else
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (n < 1) { n = 1; }
+#endif
+	}
+	threadCount = n;
+}
+
+int getThreadCount()
+{
+	return threadCount;
+}
+
+/*****************************************************************
+ * Run tasks 0..nTasks-1 in pool (or serially if pool not available)
+ */
+void parallelFor( int nTasks, parallelTask_t task, void *ctx )
+{
+	if (nTasks <= 0 || task == NULL) { return; }
+
+#ifndef _WIN32
+	if (threadCount > 1 && nTasks > 1){
+
+		pthread_mutex_lock(&poolLock);
+
+		if (!poolBusy){
+
+			while (poolWorkers < threadCount-1){ //start more workers if needed
+				pthread_t thread;
+				if (pthread_create( &thread, NULL, poolWorker, (void*)(long)poolWorkers ) != 0){
+					break;
+				}
+				pthread_detach(thread);
+				poolWorkers++;
+			}
+
+			poolBusy  = true;
+			poolTask  = task;
+			poolCtx   = ctx;
+			poolTasks = nTasks;
+			poolNext  = 0;
+			poolDone  = 0;
+			poolJob++;
+			pthread_cond_broadcast(&poolStart);
+
+			runPoolTasks(); //calling thread works too
+
+			while (poolDone < poolTasks){
+				pthread_cond_wait(&poolFinished, &poolLock);
+			}
+			poolBusy = false;
+			pthread_mutex_unlock(&poolLock);
+			return;
+		}
+		pthread_mutex_unlock(&poolLock); //busy (nested call) -> serial
+	}
+#endif
+
+	for (int id = 0; id < nTasks; id++){
+		task( id, ctx );
+	}
+}
+
+/*****************************************************************
+ * Split rows to one band per thread
+ */
+typedef struct _rowBands{
+	int rows;
+	int bands;
+	rowBandTask_t task;
+	void *ctx;
+}rowBands_t;
+
+static void runRowBand( int id, void *ctx )
+{
+	rowBands_t *b = (rowBands_t*)ctx;
+	int rowStart = (int)(((int64_t)(*b).rows * id) / (*b).bands);
+	int rowEnd   = (int)(((int64_t)(*b).rows * (id+1)) / (*b).bands);
+	if (rowEnd > rowStart){
+		(*b).task( rowStart, rowEnd, (*b).ctx );
+	}
+}
+
+void parallelRows( int rows, rowBandTask_t task, void *ctx )
+{
+	if (rows <= 0 || task == NULL) { return; }
+
+	int bands = threadCount < rows ? threadCount : rows;
+	if (bands <= 1){
+		task( 0, rows, ctx );
+		return;
+	}
+
+	rowBands_t b;
+	b.rows  = rows;
+	b.bands = bands;
+	b.task  = task;
+	b.ctx   = ctx;
+	parallelFor( bands, runRowBand, &b );
+}
+
+/*****************************************************************
+ * One pool task per worker, the workers take ids until none left
+ */
+typedef struct _workerJob{
+	int nTasks;
+	int next;          //next id to hand out
+	workerTask_t task;
+	void *ctx;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+}workerJob_t;
+
+static void runWorker( int worker, void *ctx )
+{
+	workerJob_t *job = (workerJob_t*)ctx;
+
+	while (true){
+#ifndef _WIN32
+		pthread_mutex_lock(&(*job).lock);
+#endif
+		int id = (*job).next++;
+#ifndef _WIN32
+		pthread_mutex_unlock(&(*job).lock);
+#endif
+		if (id >= (*job).nTasks) { break; }
+		(*job).task( worker, id, (*job).ctx );
+	}
+}
+
+void parallelWorkers( int nTasks, workerTask_t task, void *ctx )
+{
+	if (nTasks <= 0 || task == NULL) { return; }
+
+	workerJob_t job;
+	job.nTasks = nTasks;
+	job.next   = 0;
+	job.task   = task;
+	job.ctx    = ctx;
+#ifndef _WIN32
+	pthread_mutex_init(&job.lock, NULL);
+#endif
+
+	parallelFor( threadCount < nTasks ? threadCount : nTasks, runWorker, &job );
+
+#ifndef _WIN32
+	pthread_mutex_destroy(&job.lock);
+#endif
+}
@@ -0,0 +1,246 @@
+/*****************************************************************
+ * simdKernels.cpp
+ *
+ * implement simdKernels.h (cpu detection, dispatch and plain C kernels)
+ * The instruction set specific kernels are in simdKernels<ISA>.cpp
+ *
+ * Sami Varjo 2014
+ *****************************************************************/
+
+#include "simdKernels.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_SIMD_KERNELS)
+	#define SIMD_X86 1
+	#include <cpuid.h>
+#endif
+
+static int simdLevel = -1; //not yet detected
+
+/*****************************************************************
+ * Find the best level supported by cpu (and OS for AVX registers)
+ */
+static simdLevel_e detectSimdLevel()
+{
+	simdLevel_e level = SIMD_NONE;
+#ifdef SIMD_X86
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) { return SIMD_NONE; }
+
+	if (ecx & bit_SSE4_1) { level = SIMD_SSE41; }
+
+	if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)){
+		unsigned int xcr0, xcr0h;
+		__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a"(xcr0), "=d"(xcr0h) : "c"(0)); //xgetbv
+		if ((xcr0 & 6) == 6 && __get_cpuid_max(0, 0) >= 7){ //XMM and YMM state saved by OS
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			if (ebx & (1 << 5)) { level = SIMD_AVX2; }
+		}
+	}
+#endif
+	return level;
+}
+
+simdLevel_e getSimdLevel()
+{
+	if (simdLevel < 0){
+		simdLevel = detectSimdLevel();
+	}
+	return (simdLevel_e)simdLevel;
+}
+
+void setSimdLevel( simdLevel_e level )
+{
+	simdLevel_e supported = detectSimdLevel();
+	simdLevel = level < supported ? level : supported;
+}
+
+const char* simdLevelName( simdLevel_e level )
+{
+	switch (level){
+		case SIMD_SSE41: return "SSE4.1";
+		case SIMD_AVX2:  return "AVX2";
+		default:         return "none";
+	}
+}
+
+/*****************************************************************
+ * out[i] += in[i]*weight
+ */
+void addWeightedU16( const unsigned short *in, float weight, float *out, int count )
+{
+	switch (getSimdLevel()){
+#ifdef SIMD_X86
+		case SIMD_AVX2:
+			addWeightedU16_AVX2( in, weight, out, count );
+			break;
+		case SIMD_SSE41:
+			addWeightedU16_SSE41( in, weight, out, count );
+			break;
+#endif
+		default:
+			addWeightedU16_C( in, weight, out, count );
+			break;
+	}
+}
+
+void addWeightedU16_C( const unsigned short *in, float weight, float *out, int count )
+{
+	while(count-- > 0){
+		*out++ += (*in++) * weight;
+	}
+}
+
+/*****************************************************************
+ * out[i] += in[i]*weight (64 bit integer)
+ */
+void addScaledU16( const unsigned short *in, uint32_t weight, uint64_t *out, int count )
+{
+	switch (getSimdLevel()){
+#ifdef SIMD_X86
+		case SIMD_AVX2:
+			addScaledU16_AVX2( in, weight, out, count );
+			break;
+		case SIMD_SSE41:
+			addScaledU16_SSE41( in, weight, out, count );
+			break;
+#endif
+		default:
+			addScaledU16_C( in, weight, out, count );
+			break;
+	}
+}
+
+void addScaledU16_C( const unsigned short *in, uint32_t weight, uint64_t *out, int count )
+{
+	while(count-- > 0){
+		*out++ += (uint64_t)(*in++) * weight;
+	}
+}
+
+/*****************************************************************
+ * min and max of float data (NaN skipped)
+ */
+void minMaxF32( const float *in, int count, float *minVal, float *maxVal )
+{
+	switch (getSimdLevel()){
+#ifdef SIMD_X86
+		case SIMD_AVX2:
+			minMaxF32_AVX2( in, count, minVal, maxVal );
+			break;
+		case SIMD_SSE41:
+			minMaxF32_SSE41( in, count, minVal, maxVal );
+			break;
+#endif
+		default:
+			minMaxF32_C( in, count, minVal, maxVal );
+			break;
+	}
+}
+
+void minMaxF32_C( const float *in, int count, float *minVal, float *maxVal )
+{
+	float mn = *minVal;
+	float mx = *maxVal;
+	while(count-- > 0){
+		float val = *in++;
+		mn = (val < mn) ? val : mn;
+		mx = (val > mx) ? val : mx;
+	}
+	*minVal = mn;
+	*maxVal = mx;
+}
+
+/*****************************************************************
+ * out[i] = log(1+in[i]) (Cephes logf polynomial)
+ */
+void log1pF32( const float *in, float *out, int count )
+{
+	switch (getSimdLevel()){
+#ifdef SIMD_X86
+		case SIMD_AVX2:
+			log1pF32_AVX2( in, out, count );
+			break;
+		case SIMD_SSE41:
+			log1pF32_SSE41( in, out, count );
+			break;
+#endif
+		default:
+			log1pF32_C( in, out, count );
+			break;
+	}
+}
+
+void log1pF32_C( const float *in, float *out, int count )
+{
+	while(count-- > 0){
+		float x = 1 + *in++;
+		uint32_t u;
+		memcpy( &u, &x, sizeof(u) );
+		float e = (float)((int)(u >> 23) - 126);    //x = m*2^e, m in [0.5 1)
+		u = (u & 0x007fffff) | 0x3f000000;
+		float m;
+		memcpy( &m, &u, sizeof(m) );
+		if (m < 0.707106781186547524f){             //m to [sqrt(0.5) sqrt(2))
+			e = e - 1;
+			m = (m + m) - 1;
+		}
+		else{
+			m = m - 1;
+		}
+		float z = m*m;
+		float y = 7.0376836292E-2f;
+		y = y*m - 1.1514610310E-1f;
+		y = y*m + 1.1676998740E-1f;
+		y = y*m - 1.2420140846E-1f;
+		y = y*m + 1.4249322787E-1f;
+		y = y*m - 1.6668057665E-1f;
+		y = y*m + 2.0000714765E-1f;
+		y = y*m - 2.4999993993E-1f;
+		y = y*m + 3.3333331174E-1f;
+		y = (y*m)*z;
+		y = y + e*(-2.12194440E-4f);
+		y = y - 0.5f*z;
+		*out++ = (m + y) + e*0.693359375f;         //ln2 split in two parts
+	}
+}
+
+/*****************************************************************
+ * CLAHE interpolation of a sub-block row, division by num with a reciprocal
+ */
+void claheBlendU16( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                    const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                    uint32_t yCoef, uint32_t yInvCoef, uint32_t num )
+{
+	switch (getSimdLevel()){
+#ifdef SIMD_X86
+		case SIMD_AVX2:
+			claheBlendU16_AVX2( in, out, first, width, lut, mapLU, mapRU, mapLB, mapRB, yCoef, yInvCoef, num );
+			break;
+		case SIMD_SSE41:
+			claheBlendU16_SSE41( in, out, first, width, lut, mapLU, mapRU, mapLB, mapRB, yCoef, yInvCoef, num );
+			break;
+#endif
+		default:
+			claheBlendU16_C( in, out, first, width, lut, mapLU, mapRU, mapLB, mapRB, yCoef, yInvCoef, num );
+			break;
+	}
+}
+
+void claheBlendU16_C( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                      const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                      uint32_t yCoef, uint32_t yInvCoef, uint32_t num )
+{
+	const float recip = 1.0f/num;
+	for (int i = first; i < width; i++){
+		uint32_t bin = lut[in[i]];
+		uint32_t x = i, xInv = width - i;
+		int32_t val = (int32_t)(yInvCoef*(xInv*mapLU[bin] + x*mapRU[bin]) + yCoef*(xInv*mapLB[bin] + x*mapRB[bin]));
+		int32_t q = (int32_t)(val*recip);        //within one of val/num
+		int32_t r = val - q*(int32_t)num;
+		q += (r >= (int32_t)num) - (r < 0);
+		out[i] = (unsigned short)q;
+	}
+}
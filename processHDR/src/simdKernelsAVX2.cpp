@@ -0,0 +1,168 @@
+/*****************************************************************
+ * simdKernelsAVX2.cpp
+ *
+ * AVX2 versions of kernels in simdKernels.h
+ * (compiled with -mavx2, called only if cpu supports it)
+ * OBS do not compile with -mfma, the compiler would fuse mul+add
+ * and the results would differ from the plain C version.
+ *
+ * Sami Varjo 2014
+ *****************************************************************/
+
+#include "simdKernels.h"
+
+#include <immintrin.h>
+
+/*****************************************************************
+ * out[i] += in[i]*weight, 16 pixels at a time
+ */
+void addWeightedU16_AVX2( const unsigned short *in, float weight, float *out, int count )
+{
+	const __m256 w = _mm256_set1_ps(weight);
+
+	while (count >= 16){
+		__m128i pixLo = _mm_loadu_si128((const __m128i*)in);
+		__m128i pixHi = _mm_loadu_si128((const __m128i*)(in+8));
+		__m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(pixLo));
+		__m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(pixHi));
+
+		_mm256_storeu_ps(out,   _mm256_add_ps(_mm256_loadu_ps(out),   _mm256_mul_ps(lo, w)));
+		_mm256_storeu_ps(out+8, _mm256_add_ps(_mm256_loadu_ps(out+8), _mm256_mul_ps(hi, w)));
+
+		in += 16; out += 16; count -= 16;
+	}
+
+	addWeightedU16_C( in, weight, out, count ); //tail
+}
+
+/*****************************************************************
+ * out[i] += in[i]*weight (64 bit), 16 pixels at a time
+ */
+void addScaledU16_AVX2( const unsigned short *in, uint32_t weight, uint64_t *out, int count )
+{
+	const __m256i w = _mm256_set1_epi32((int)weight);
+
+	while (count >= 16){
+		__m128i pixLo = _mm_loadu_si128((const __m128i*)in);
+		__m128i pixHi = _mm_loadu_si128((const __m128i*)(in+8));
+		__m128i pix[4] = { pixLo, _mm_srli_si128(pixLo, 8), pixHi, _mm_srli_si128(pixHi, 8) };
+
+		for (int k = 0; k < 4; k++){ //4 pixels widened to 64 bits at a time
+			__m256i p64 = _mm256_cvtepu16_epi64(pix[k]);
+			__m256i o = _mm256_loadu_si256((const __m256i*)(out+4*k));
+			_mm256_storeu_si256((__m256i*)(out+4*k), _mm256_add_epi64(o, _mm256_mul_epu32(p64, w)));
+		}
+
+		in += 16; out += 16; count -= 16;
+	}
+
+	addScaledU16_C( in, weight, out, count ); //tail
+}
+
+/*****************************************************************
+ * min and max of float data, 8 values at a time in lanes
+ * (minps(a,b) is a < b ? a : b so NaN values are skipped as in C)
+ */
+void minMaxF32_AVX2( const float *in, int count, float *minVal, float *maxVal )
+{
+	if (count >= 8){
+		__m256 mn = _mm256_set1_ps(*minVal);
+		__m256 mx = _mm256_set1_ps(*maxVal);
+
+		while (count >= 8){
+			__m256 val = _mm256_loadu_ps(in);
+			mn = _mm256_min_ps(val, mn);
+			mx = _mm256_max_ps(val, mx);
+			in += 8; count -= 8;
+		}
+
+		float lanes[8];
+		_mm256_storeu_ps(lanes, mn);
+		minMaxF32_C( lanes, 8, minVal, maxVal );
+		_mm256_storeu_ps(lanes, mx);
+		minMaxF32_C( lanes, 8, minVal, maxVal );
+	}
+
+	minMaxF32_C( in, count, minVal, maxVal ); //tail
+}
+
+/*****************************************************************
+ * out[i] = log(1+in[i]), 8 values at a time (same operations as in C)
+ */
+void log1pF32_AVX2( const float *in, float *out, int count )
+{
+	const __m256i mantMask = _mm256_set1_epi32(0x007fffff);
+	const __m256i half     = _mm256_set1_epi32(0x3f000000);
+	const __m256i bias     = _mm256_set1_epi32(126);
+	const __m256 one   = _mm256_set1_ps(1.0f);
+	const __m256 sqrth = _mm256_set1_ps(0.707106781186547524f);
+	const __m256 c[9] = { _mm256_set1_ps(7.0376836292E-2f), _mm256_set1_ps(-1.1514610310E-1f), _mm256_set1_ps(1.1676998740E-1f),
+	                     _mm256_set1_ps(-1.2420140846E-1f), _mm256_set1_ps(1.4249322787E-1f), _mm256_set1_ps(-1.6668057665E-1f),
+	                     _mm256_set1_ps(2.0000714765E-1f), _mm256_set1_ps(-2.4999993993E-1f), _mm256_set1_ps(3.3333331174E-1f) };
+
+	while (count >= 8){
+		__m256 x = _mm256_add_ps(one, _mm256_loadu_ps(in));
+		__m256i u = _mm256_castps_si256(x);
+		__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(u, 23), bias));
+		__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(u, mantMask), half));
+		__m256 small = _mm256_cmp_ps(m, sqrth, _CMP_LT_OQ);
+		e = _mm256_sub_ps(e, _mm256_and_ps(small, one));
+		m = _mm256_sub_ps(_mm256_blendv_ps(m, _mm256_add_ps(m, m), small), one);
+
+		__m256 z = _mm256_mul_ps(m, m);
+		__m256 y = c[0];
+		for (int k = 1; k < 9; k++){
+			y = _mm256_add_ps(_mm256_mul_ps(y, m), c[k]);
+		}
+		y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+		y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440E-4f)));
+		y = _mm256_sub_ps(y, _mm256_mul_ps(_mm256_set1_ps(0.5f), z));
+		_mm256_storeu_ps(out, _mm256_add_ps(_mm256_add_ps(m, y), _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f))));
+
+		in += 8; out += 8; count -= 8;
+	}
+
+	log1pF32_C( in, out, count ); //tail
+}
+
+/*****************************************************************
+ * CLAHE interpolation of a sub-block row, 8 pixels at a time
+ * (bins and mappings gathered, same operations as in C)
+ */
+void claheBlendU16_AVX2( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                         const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                         uint32_t yCoef, uint32_t yInvCoef, uint32_t num )
+{
+	const __m256 recip = _mm256_set1_ps(1.0f/num);
+	const __m256i n = _mm256_set1_epi32((int)num);
+	const __m256i nLess = _mm256_set1_epi32((int)num-1);
+	const __m256i yc = _mm256_set1_epi32((int)yCoef);
+	const __m256i yi = _mm256_set1_epi32((int)yInvCoef);
+	const __m256i w = _mm256_set1_epi32(width);
+	__m256i x = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	while (first + 8 <= width){
+		__m256i pix = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in+first)));
+		__m256i bin = _mm256_i32gather_epi32((const int*)lut, pix, 4);
+		__m256i lu = _mm256_i32gather_epi32((const int*)mapLU, bin, 4);
+		__m256i ru = _mm256_i32gather_epi32((const int*)mapRU, bin, 4);
+		__m256i lb = _mm256_i32gather_epi32((const int*)mapLB, bin, 4);
+		__m256i rb = _mm256_i32gather_epi32((const int*)mapRB, bin, 4);
+		__m256i xInv = _mm256_sub_epi32(w, x);
+
+		__m256i up = _mm256_add_epi32(_mm256_mullo_epi32(xInv, lu), _mm256_mullo_epi32(x, ru));
+		__m256i low = _mm256_add_epi32(_mm256_mullo_epi32(xInv, lb), _mm256_mullo_epi32(x, rb));
+		__m256i val = _mm256_add_epi32(_mm256_mullo_epi32(yi, up), _mm256_mullo_epi32(yc, low));
+		__m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(val), recip));
+		__m256i r = _mm256_sub_epi32(val, _mm256_mullo_epi32(q, n));
+		q = _mm256_sub_epi32(q, _mm256_cmpgt_epi32(r, nLess));                  //r >= num: +1
+		q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(_mm256_setzero_si256(), r)); //r < 0: -1
+
+		__m128i q16 = _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+		_mm_storeu_si128((__m128i*)(out+first), q16);
+		x = _mm256_add_epi32(x, _mm256_set1_epi32(8));
+		first += 8;
+	}
+
+	claheBlendU16_C( in, out, first, width, lut, mapLU, mapRU, mapLB, mapRB, yCoef, yInvCoef, num ); //tail
+}
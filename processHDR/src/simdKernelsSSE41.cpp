@@ -0,0 +1,162 @@
+/*****************************************************************
+ * simdKernelsSSE41.cpp
+ *
+ * SSE 4.1 versions of kernels in simdKernels.h
+ * (compiled with -msse4.1, called only if cpu supports it)
+ *
+ * Sami Varjo 2014
+ *****************************************************************/
+
+#include "simdKernels.h"
+
+#include <smmintrin.h>
+
+/*****************************************************************
+ * out[i] += in[i]*weight, 8 pixels at a time
+ */
+void addWeightedU16_SSE41( const unsigned short *in, float weight, float *out, int count )
+{
+	const __m128 w = _mm_set1_ps(weight);
+
+	while (count >= 8){
+		__m128i pix = _mm_loadu_si128((const __m128i*)in);
+		__m128 lo = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(pix));
+		__m128 hi = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(pix, 8)));
+
+		_mm_storeu_ps(out,   _mm_add_ps(_mm_loadu_ps(out),   _mm_mul_ps(lo, w)));
+		_mm_storeu_ps(out+4, _mm_add_ps(_mm_loadu_ps(out+4), _mm_mul_ps(hi, w)));
+
+		in += 8; out += 8; count -= 8;
+	}
+
+	addWeightedU16_C( in, weight, out, count ); //tail
+}
+
+/*****************************************************************
+ * out[i] += in[i]*weight (64 bit), 8 pixels at a time
+ */
+void addScaledU16_SSE41( const unsigned short *in, uint32_t weight, uint64_t *out, int count )
+{
+	const __m128i w = _mm_set1_epi32((int)weight);
+
+	while (count >= 8){
+		__m128i pix = _mm_loadu_si128((const __m128i*)in);
+
+		for (int k = 0; k < 4; k++){ //2 pixels widened to 64 bits at a time
+			__m128i p64 = _mm_cvtepu16_epi64(pix);
+			__m128i o = _mm_loadu_si128((const __m128i*)(out+2*k));
+			_mm_storeu_si128((__m128i*)(out+2*k), _mm_add_epi64(o, _mm_mul_epu32(p64, w)));
+			pix = _mm_srli_si128(pix, 4);
+		}
+
+		in += 8; out += 8; count -= 8;
+	}
+
+	addScaledU16_C( in, weight, out, count ); //tail
+}
+
+/*****************************************************************
+ * min and max of float data, 4 values at a time in lanes
+ * (minps(a,b) is a < b ? a : b so NaN values are skipped as in C)
+ */
+void minMaxF32_SSE41( const float *in, int count, float *minVal, float *maxVal )
+{
+	if (count >= 4){
+		__m128 mn = _mm_set1_ps(*minVal);
+		__m128 mx = _mm_set1_ps(*maxVal);
+
+		while (count >= 4){
+			__m128 val = _mm_loadu_ps(in);
+			mn = _mm_min_ps(val, mn);
+			mx = _mm_max_ps(val, mx);
+			in += 4; count -= 4;
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, mn);
+		minMaxF32_C( lanes, 4, minVal, maxVal );
+		_mm_storeu_ps(lanes, mx);
+		minMaxF32_C( lanes, 4, minVal, maxVal );
+	}
+
+	minMaxF32_C( in, count, minVal, maxVal ); //tail
+}
+
+/*****************************************************************
+ * out[i] = log(1+in[i]), 4 values at a time (same operations as in C)
+ */
+void log1pF32_SSE41( const float *in, float *out, int count )
+{
+	const __m128i mantMask = _mm_set1_epi32(0x007fffff);
+	const __m128i half     = _mm_set1_epi32(0x3f000000);
+	const __m128i bias     = _mm_set1_epi32(126);
+	const __m128 one   = _mm_set1_ps(1.0f);
+	const __m128 sqrth = _mm_set1_ps(0.707106781186547524f);
+	const __m128 c[9] = { _mm_set1_ps(7.0376836292E-2f), _mm_set1_ps(-1.1514610310E-1f), _mm_set1_ps(1.1676998740E-1f),
+	                  _mm_set1_ps(-1.2420140846E-1f), _mm_set1_ps(1.4249322787E-1f), _mm_set1_ps(-1.6668057665E-1f),
+	                  _mm_set1_ps(2.0000714765E-1f), _mm_set1_ps(-2.4999993993E-1f), _mm_set1_ps(3.3333331174E-1f) };
+
+	while (count >= 4){
+		__m128 x = _mm_add_ps(one, _mm_loadu_ps(in));
+		__m128i u = _mm_castps_si128(x);
+		__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(u, 23), bias));
+		__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(u, mantMask), half));
+		__m128 small = _mm_cmplt_ps(m, sqrth);
+		e = _mm_sub_ps(e, _mm_and_ps(small, one));
+		m = _mm_sub_ps(_mm_blendv_ps(m, _mm_add_ps(m, m), small), one);
+
+		__m128 z = _mm_mul_ps(m, m);
+		__m128 y = c[0];
+		for (int k = 1; k < 9; k++){
+			y = _mm_add_ps(_mm_mul_ps(y, m), c[k]);
+		}
+		y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+		y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(-2.12194440E-4f)));
+		y = _mm_sub_ps(y, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+		_mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(e, _mm_set1_ps(0.693359375f))));
+
+		in += 4; out += 4; count -= 4;
+	}
+
+	log1pF32_C( in, out, count ); //tail
+}
+
+/*****************************************************************
+ * CLAHE interpolation of a sub-block row, 4 pixels at a time
+ * (bins and mappings looked up one by one, same operations as in C)
+ */
+void claheBlendU16_SSE41( const unsigned short *in, unsigned short *out, int first, int width, const uint32_t *lut,
+                          const uint32_t *mapLU, const uint32_t *mapRU, const uint32_t *mapLB, const uint32_t *mapRB,
+                          uint32_t yCoef, uint32_t yInvCoef, uint32_t num )
+{
+	const __m128 recip = _mm_set1_ps(1.0f/num);
+	const __m128i n = _mm_set1_epi32((int)num);
+	const __m128i nLess = _mm_set1_epi32((int)num-1);
+	const __m128i yc = _mm_set1_epi32((int)yCoef);
+	const __m128i yi = _mm_set1_epi32((int)yInvCoef);
+	const __m128i w = _mm_set1_epi32(width);
+	__m128i x = _mm_add_epi32(_mm_set1_epi32(first), _mm_setr_epi32(0, 1, 2, 3));
+
+	while (first + 4 <= width){
+		uint32_t b0 = lut[in[first]], b1 = lut[in[first+1]], b2 = lut[in[first+2]], b3 = lut[in[first+3]];
+		__m128i lu = _mm_setr_epi32(mapLU[b0], mapLU[b1], mapLU[b2], mapLU[b3]);
+		__m128i ru = _mm_setr_epi32(mapRU[b0], mapRU[b1], mapRU[b2], mapRU[b3]);
+		__m128i lb = _mm_setr_epi32(mapLB[b0], mapLB[b1], mapLB[b2], mapLB[b3]);
+		__m128i rb = _mm_setr_epi32(mapRB[b0], mapRB[b1], mapRB[b2], mapRB[b3]);
+		__m128i xInv = _mm_sub_epi32(w, x);
+
+		__m128i up = _mm_add_epi32(_mm_mullo_epi32(xInv, lu), _mm_mullo_epi32(x, ru));
+		__m128i low = _mm_add_epi32(_mm_mullo_epi32(xInv, lb), _mm_mullo_epi32(x, rb));
+		__m128i val = _mm_add_epi32(_mm_mullo_epi32(yi, up), _mm_mullo_epi32(yc, low));
+		__m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(val), recip));
+		__m128i r = _mm_sub_epi32(val, _mm_mullo_epi32(q, n));
+		q = _mm_sub_epi32(q, _mm_cmpgt_epi32(r, nLess));                 //r >= num: +1
+		q = _mm_add_epi32(q, _mm_cmplt_epi32(r, _mm_setzero_si128()));  //r < 0: -1
+
+		_mm_storel_epi64((__m128i*)(out+first), _mm_packus_epi32(q, q));
+		x = _mm_add_epi32(x, _mm_set1_epi32(4));
+		first += 4;
+	}
+
+	claheBlendU16_C( in, out, first, width, lut, mapLU, mapRU, mapLB, mapRB, yCoef, yInvCoef, num ); //tail
+}
@@ -0,0 +1,244 @@
+/*****************************************************************
+ * stackPipeline.cpp
+ *
+ * implement stackPipeline.h
+ *
+ * Sami Varjo 2014
+ *****************************************************************/
+
+#include "stackPipeline.h"
+
+#include <cstdlib>
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
+
+//slot states
+enum { SLOT_DECODING, SLOT_READY, SLOT_FAILED };
+
+#ifndef _WIN32
+//The thread state (all protected by lock)
+typedef struct _pipeSync{
+	pthread_mutex_t lock;
+	pthread_cond_t  frameDone;   //a frame decoded
+	pthread_cond_t  slotFree;    //a buffer recycled, limit lowered or stopped
+	std::vector<pthread_t> threads;
+	int next;                    //next id to decode
+	int limit;                   //last id to decode
+	bool stop;
+}pipeSync_t;
+
+/*
+ * Index of a free buffer (-1 if none)
+ */
+static int freeSlot( stackPipeline_t *pipe )
+{
+	for (unsigned int s = 0; s < (*pipe).slotId.size(); s++){
+		if ((*pipe).slotId[s] < 0) { return s; }
+	}
+	return -1;
+}
+
+/*
+ * Decode thread main loop: take next id when there is a free buffer
+ */
+static void* decodeThread( void *arg )
+{
+	stackPipeline_t *pipe = (stackPipeline_t*)arg;
+	pipeSync_t *sync = (pipeSync_t*)(*pipe).sync;
+
+	pthread_mutex_lock(&(*sync).lock);
+	while (true){
+		int slot = -1;
+		while (!(*sync).stop && (*sync).next <= (*sync).limit && (slot = freeSlot(pipe)) < 0){
+			pthread_cond_wait(&(*sync).slotFree, &(*sync).lock);
+		}
+		if ((*sync).stop || (*sync).next > (*sync).limit) { break; }
+
+		int id = (*sync).next++;
+		(*pipe).slotId[slot] = id;
+		(*pipe).slotState[slot] = SLOT_DECODING;
+
+		pthread_mutex_unlock(&(*sync).lock);
+		int rval = (*pipe).decode( id, &(*pipe).frames[slot], (*pipe).ctx );
+		pthread_mutex_lock(&(*sync).lock);
+
+		(*pipe).slotState[slot] = rval < 0 ? SLOT_FAILED : SLOT_READY;
+		pthread_cond_broadcast(&(*sync).frameDone);
+	}
+	pthread_mutex_unlock(&(*sync).lock);
+	return NULL;
+}
+#endif
+
+/*****************************************************************
+ * Start decode threads for a new stack
+ */
+int stackPipelineStart( stackPipeline_t *pipe, int nFrames, int decoders, int buffers, frameDecoder_t decode, void *ctx )
+{
+	if (pipe == NULL || decode == NULL || nFrames < 1) { return -2; }
+
+#ifdef _WIN32
+	decoders = 0;
+#endif
+	if (decoders < 0) { decoders = 0; }
+	if (buffers < decoders+1) { buffers = decoders+1; }
+
+	(*pipe).frames.resize( buffers ); //old buffers are kept
+	(*pipe).slotId.assign( buffers, -1 );
+	(*pipe).slotState.assign( buffers, SLOT_READY );
+	(*pipe).nFrames  = nFrames;
+	(*pipe).decoders = 0;
+	(*pipe).decode   = decode;
+	(*pipe).ctx      = ctx;
+	(*pipe).sync     = NULL;
+
+#ifndef _WIN32
+	if (decoders > 0){
+		pipeSync_t *sync = new pipeSync_t;
+		pthread_mutex_init(&(*sync).lock, NULL);
+		pthread_cond_init(&(*sync).frameDone, NULL);
+		pthread_cond_init(&(*sync).slotFree, NULL);
+		(*sync).next  = 0;
+		(*sync).limit = nFrames-1;
+		(*sync).stop  = false;
+		(*pipe).sync  = sync;
+
+		for (int t = 0; t < decoders; t++){
+			pthread_t thread;
+			if (pthread_create( &thread, NULL, decodeThread, pipe ) != 0){
+				break;
+			}
+			(*sync).threads.push_back(thread);
+		}
+		(*pipe).decoders = (*sync).threads.size();
+
+		if ((*pipe).decoders == 0){ //no threads, decode when asked
+			stackPipelineStop( pipe );
+		}
+	}
+#endif
+	return 0;
+}
+
+/*****************************************************************
+ * Wait for image id
+ */
+commonImage_t* stackPipelineGet( stackPipeline_t *pipe, int id )
+{
+	if (pipe == NULL || id < 0 || id >= (*pipe).nFrames) { return NULL; }
+
+#ifndef _WIN32
+	pipeSync_t *sync = (pipeSync_t*)(*pipe).sync;
+	if (sync != NULL){
+		commonImage_t *frame = NULL;
+
+		pthread_mutex_lock(&(*sync).lock);
+		while (true){
+			int slot = -1;
+			for (unsigned int s = 0; s < (*pipe).slotId.size(); s++){
+				if ((*pipe).slotId[s] == id) { slot = s; }
+			}
+			if (slot >= 0 && (*pipe).slotState[slot] != SLOT_DECODING){
+				frame = (*pipe).slotState[slot] == SLOT_READY ? &(*pipe).frames[slot] : NULL;
+				break;
+			}
+			if (slot < 0 && (id > (*sync).limit || (*sync).stop)) { break; } //will not be decoded
+			pthread_cond_wait(&(*sync).frameDone, &(*sync).lock);
+		}
+		pthread_mutex_unlock(&(*sync).lock);
+		return frame;
+	}
+#endif
+
+	//no threads, decode to the first buffer
+	(*pipe).slotId[0] = id;
+	if ((*pipe).decode( id, &(*pipe).frames[0], (*pipe).ctx ) < 0){
+		return NULL;
+	}
+	return &(*pipe).frames[0];
+}
+
+/*****************************************************************
+ * Buffer of id back to use
+ */
+void stackPipelineRecycle( stackPipeline_t *pipe, int id )
+{
+	if (pipe == NULL) { return; }
+
+#ifndef _WIN32
+	pipeSync_t *sync = (pipeSync_t*)(*pipe).sync;
+	if (sync != NULL){ pthread_mutex_lock(&(*sync).lock); }
+#endif
+	for (unsigned int s = 0; s < (*pipe).slotId.size(); s++){
+		if ((*pipe).slotId[s] == id) { (*pipe).slotId[s] = -1; }
+	}
+#ifndef _WIN32
+	if (sync != NULL){
+		pthread_cond_broadcast(&(*sync).slotFree);
+		pthread_mutex_unlock(&(*sync).lock);
+	}
+#endif
+}
+
+/*****************************************************************
+ * Lower the last id decoded
+ */
+void stackPipelineLimit( stackPipeline_t *pipe, int lastId )
+{
+	if (pipe == NULL) { return; }
+
+#ifndef _WIN32
+	pipeSync_t *sync = (pipeSync_t*)(*pipe).sync;
+	if (sync != NULL){
+		pthread_mutex_lock(&(*sync).lock);
+		if (lastId < (*sync).limit) { (*sync).limit = lastId; }
+		pthread_cond_broadcast(&(*sync).slotFree);
+		pthread_mutex_unlock(&(*sync).lock);
+	}
+#endif
+}
+
+/*****************************************************************
+ * End decode threads
+ */
+void stackPipelineStop( stackPipeline_t *pipe )
+{
+	if (pipe == NULL) { return; }
+
+#ifndef _WIN32
+	pipeSync_t *sync = (pipeSync_t*)(*pipe).sync;
+	if (sync != NULL){
+		pthread_mutex_lock(&(*sync).lock);
+		(*sync).stop = true;
+		pthread_cond_broadcast(&(*sync).slotFree);
+		pthread_mutex_unlock(&(*sync).lock);
+
+		for (unsigned int t = 0; t < (*sync).threads.size(); t++){
+			pthread_join( (*sync).threads[t], NULL );
+		}
+		pthread_cond_destroy(&(*sync).frameDone);
+		pthread_cond_destroy(&(*sync).slotFree);
+		pthread_mutex_destroy(&(*sync).lock);
+		delete sync;
+		(*pipe).sync = NULL;
+	}
+#endif
+	(*pipe).decoders = 0;
+	(*pipe).slotId.assign( (*pipe).slotId.size(), -1 );
+}
+
+/*****************************************************************
+ * Free frame buffers
+ */
+void stackPipelineRelease( stackPipeline_t *pipe )
+{
+	if (pipe == NULL) { return; }
+
+	stackPipelineStop( pipe );
+	for (unsigned int s = 0; s < (*pipe).frames.size(); s++){
+		if ((*pipe).frames[s].data != NULL) { free((*pipe).frames[s].data); }
+		(*pipe).frames[s].data = NULL;
+	}
+}